@@ -51,10 +51,43 @@
 
 namespace Angel {
 
+//  Uniform block binding points: InitShader() binds every program's "Frame"
+//    block (per-frame data such as P) and "Object" block (per-draw data
+//    such as MV) to these
+const GLuint  FrameBlockBinding = 0;
+const GLuint  ObjectBlockBinding = 1;
+
 //  Helper function to load vertex and fragment shader files
 GLuint InitShader( const char* vertexShaderFile,
                    const char* fragmentShaderFile );
 
+//  Keep linked program binaries in the given directory (which must end in
+//    a path separator) and reuse them on later runs; NULL disables this
+void SetProgramBinaryCache( const char* directory );
+
+//  Helper function to load a vertex shader whose outputs are captured
+//    with transform feedback (no fragment stage)
+GLuint InitTransformFeedbackShader( const char* vertexShaderFile,
+                                    const GLchar** varyings,
+                                    GLsizei numVaryings );
+
+//  Return the program for a pair of shader files, reading, compiling and
+//    linking them only if no live program was built from the same files.
+//    Each call holds a reference that ReleaseProgram() drops, deleting the
+//    program with the last one.
+GLuint AcquireProgram( const char* vertexShaderFile,
+                       const char* fragmentShaderFile );
+void   ReleaseProgram( GLuint program );
+
+//  Set the shader files a program from AcquireProgram() was built from,
+//    returning false for any other program
+bool   ProgramShaderFiles( GLuint program, const char*& vertexShaderFile,
+                           const char*& fragmentShaderFile );
+
+//  Number of programs AcquireProgram() has linked, and the number of calls
+//    it answered with an existing program
+void   ProgramCacheCounts( int& linked, int& shared );
+
 //  Defined constant for when numbers are too small to be used in the
 //    denominator of a division operation.  This is only used if the
 //    DEBUG macro is defined.
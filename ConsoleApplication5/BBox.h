@@ -31,6 +31,26 @@ struct BBox {
     BBox merge( const BBox& bb ) const 
         { return BBox( Angel::min(ll, bb.ll), Angel::max(ur, bb.ur) ); }
     
+    /// Return the box, aligned to the new axes, enclosing this box's
+    ///   corners transformed by m
+    BBox transform( const Angel::mat4& m ) const {
+        Angel::vec4 corners[8];
+        for ( int i = 0; i < 8; ++i ) {
+            corners[i] = Angel::vec4( i & 1 ? ur.x : ll.x,
+                                      i & 2 ? ur.y : ll.y,
+                                      i & 4 ? ur.z : ll.z, 1.0f );
+        }
+        Angel::transform( m, corners, corners, 8 );
+
+        BBox b;
+        for ( int i = 0; i < 8; ++i ) {
+            vec3 v( corners[i].x, corners[i].y, corners[i].z );
+            b.ll = i ? Angel::min( b.ll, v ) : v;
+            b.ur = i ? Angel::max( b.ur, v ) : v;
+        }
+        return b;
+    }
+
     /// Return the center of the bounding box
     vec3 center() const 
         { return 0.5*(ur + ll); }
@@ -0,0 +1,529 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- BVH.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+#include "Angel.h"
+#include "BBox.h"
+#include "Frustum.h"
+#include "Nodes.h"
+#include "SceneGraph.h"
+#include "Traversals.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- BVH ---
+//
+/// \class BVH
+/// \brief A bounding volume hierarchy over the objects of a scene graph,
+///    for picking and spatial queries without visiting every node
+/// \details build() collects every GeometricObject and LOD node (an LOD
+///    counts as one object, whichever level is drawn) with the Transforms
+///    above it, in the flattened form RenderList uses, and builds a binary
+///    tree over their bounds in the frame of the scene graph's top-level
+///    nodes ("world" space, as BoundingBoxTraversal computes).  Each split
+///    is chosen by the surface area heuristic over Bins buckets of object
+///    centers per axis.  Subtrees of at least grain objects are built on
+///    their own threads.
+///
+///    After transforms or geometry change, refit() recomputes every
+///    object's box and the tree's boxes bottom up, keeping its shape;
+///    after nodes are added (stale()) build() again.  Queries only read
+///    the tree, so any number may run at once between updates.  The boxes
+///    are all a query tests, so a ray picks the object whose bounds it
+///    enters first, not necessarily the one whose surface it hits first.
+
+struct BVH {
+
+    typedef Angel::mat4  mat4;
+    typedef Angel::vec3  vec3;
+
+    static const int MaxLeafSize = 4;   /// objects a leaf may hold
+    static const int Bins = 16;         /// SAH buckets per axis
+
+    struct BVHNode {
+        BBox      box;
+        uint32_t  first;     /// first entry of order beneath the node
+        uint32_t  count;     /// entries of order beneath the node
+        uint32_t  children;  /// first of two adjacent children, or 0 for
+                             ///   a leaf
+    };
+
+    // --- objects, in scene graph order ---
+    std::vector<Node*>       objects;
+    std::vector<int>         owner;       /// transform index, -1 for none
+    std::vector<BBox>        boxes;       /// world-space bounds
+
+    // --- transforms above the objects, each after its parent ---
+    std::vector<Transform*>  transforms;
+    std::vector<int>         parents;     /// parent index, -1 at the top
+    std::vector<mat4>        worlds;      /// product of the xforms down to
+                                          ///   and including this one
+
+    // --- the tree ---
+    std::vector<BVHNode>     nodes;       /// nodes[0] is the root
+    std::vector<uint32_t>    order;       /// objects, each subtree's a range
+
+    unsigned       threads;    /// most build threads, or 0 for one per core
+    size_t         grain;      /// fewest objects worth a thread of their own
+    unsigned long  structure;  /// structureVersion() built from
+
+    BVH() : threads(0), grain(4096), structure(0) {}
+
+    /// True if nodes have been added, removed or replaced since the tree
+    ///   was built
+    bool stale() const
+        { return structure != structureVersion(); }
+
+    /// Number of objects
+    size_t size() const
+        { return objects.size(); }
+
+    /// Collect the objects of s and build the tree over them
+    void build( SceneGraph* s ) {
+        objects.clear();  owner.clear();  boxes.clear();
+        transforms.clear();  parents.clear();  worlds.clear();
+        nodes.clear();  order.clear();
+
+        Collector collector( *this );
+        collector.traverse( s );
+        structure = structureVersion();
+        refitBoxes();
+
+        size_t n = objects.size();
+        if ( n == 0 ) { return; }
+
+        centers.resize( n );
+        order.resize( n );
+        for ( size_t i = 0; i < n; ++i ) {
+            centers[i] = boxes[i].center();
+            order[i] = uint32_t( i );
+        }
+
+        // a tree with leaves of one object or more has under 2n nodes
+        nodes.resize( 2 * n );
+        std::atomic<uint32_t> used( 1 );
+        unsigned maxThreads =
+            threads ? threads : std::thread::hardware_concurrency();
+        int parallelDepth = 0;
+        while ( (1u << parallelDepth) < maxThreads ) { ++parallelDepth; }
+
+        _build( 0, 0, uint32_t( n ), parallelDepth, used );
+        nodes.resize( used );
+        centers.clear();
+    }
+
+    /// Recompute the world-space box of every object from its current
+    ///   bounds and transforms, then the tree's boxes, bottom up
+    void refit() {
+        refitBoxes();
+        if ( nodes.empty() ) { return; }
+
+        // children always come after their parent
+        for ( size_t i = nodes.size(); i-- > 0; ) {
+            BVHNode& node = nodes[i];
+            if ( node.children ) {
+                node.box = nodes[node.children].box.merge(
+                    nodes[node.children + 1].box );
+            }
+            else {
+                node.box = boxes[order[node.first]];
+                for ( uint32_t j = 1; j < node.count; ++j ) {
+                    node.box = node.box.merge( boxes[order[node.first + j]] );
+                }
+            }
+        }
+    }
+
+    /// Recompute the objects' world-space boxes only
+    void refitBoxes() {
+        for ( size_t i = 0; i < transforms.size(); ++i ) {
+            int p = parents[i];
+            worlds[i] = p < 0 ? transforms[i]->xform
+                              : worlds[p] * transforms[i]->xform;
+        }
+        for ( size_t i = 0; i < objects.size(); ++i ) {
+            BBox b;
+            objects[i]->bounds( b );
+            boxes[i] = owner[i] < 0 ? b : b.transform( worlds[owner[i]] );
+        }
+    }
+
+    /// Return the object whose bounds the ray from origin along dir enters
+    ///   nearest origin (at origin + *distance * dir), or NULL
+    Node* pick( const vec3& origin, const vec3& dir,
+                GLfloat* distance = NULL ) const {
+        if ( nodes.empty() ) { return NULL; }
+
+        Ray ray( origin, dir );
+        GLfloat best = std::numeric_limits<GLfloat>::infinity();
+        Node* hit = NULL;
+
+        GLfloat t;
+        if ( !ray.intersects( nodes[0].box, best, t ) ) { return NULL; }
+
+        std::vector<uint32_t> stack;
+        stack.reserve( 64 );
+        stack.push_back( 0 );
+        while ( !stack.empty() ) {
+            const BVHNode& node = nodes[stack.back()];
+            stack.pop_back();
+            if ( !ray.intersects( node.box, best, t ) ) { continue; }
+
+            if ( !node.children ) {
+                for ( uint32_t j = 0; j < node.count; ++j ) {
+                    uint32_t o = order[node.first + j];
+                    if ( ray.intersects( boxes[o], best, t ) ) {
+                        best = t;
+                        hit = objects[o];
+                    }
+                }
+                continue;
+            }
+
+            // push the farther child first, so the nearer one is searched
+            //   (and best tightened) before it
+            uint32_t c = node.children;
+            GLfloat tl, tr;
+            bool l = ray.intersects( nodes[c].box, best, tl );
+            bool r = ray.intersects( nodes[c + 1].box, best, tr );
+            if ( l && r ) {
+                bool leftFirst = tl <= tr;
+                stack.push_back( c + (leftFirst ? 1 : 0) );
+                stack.push_back( c + (leftFirst ? 0 : 1) );
+            }
+            else if ( l ) { stack.push_back( c ); }
+            else if ( r ) { stack.push_back( c + 1 ); }
+        }
+
+        if ( hit && distance ) { *distance = best; }
+        return hit;
+    }
+
+    /// Append every object whose bounds the ray from origin along dir
+    ///   passes through to hits
+    void rayQuery( const vec3& origin, const vec3& dir,
+                   std::vector<Node*>& hits ) const {
+        Ray ray( origin, dir );
+        GLfloat limit = std::numeric_limits<GLfloat>::infinity(), t;
+        _query( hits,
+            [&]( const BBox& b ) { return ray.intersects( b, limit, t ); },
+            [&]( const BBox& ) { return false; } );
+    }
+
+    /// Append every object whose bounds may lie in frustum (in world
+    ///   space, from P times the scene's MV) to hits.  Planes a box is
+    ///   wholly inside aren't tested again below it, and a box inside all
+    ///   six has its subtree appended untested.
+    void frustumQuery( const ViewFrustum& frustum,
+                       std::vector<Node*>& hits ) const {
+        if ( nodes.empty() ) { return; }
+
+        const unsigned all = (1 << 6) - 1;
+        std::vector< std::pair<uint32_t, unsigned> > stack;
+        stack.reserve( 64 );
+        stack.push_back( std::make_pair( 0u, all ) );
+        while ( !stack.empty() ) {
+            const BVHNode& node = nodes[stack.back().first];
+            unsigned planes = _clip( frustum, node.box, stack.back().second );
+            stack.pop_back();
+
+            if ( planes == Outside ) { continue; }
+            if ( planes == 0 ) {
+                _appendAll( node, hits );
+            }
+            else if ( node.children ) {
+                stack.push_back( std::make_pair( node.children + 1, planes ) );
+                stack.push_back( std::make_pair( node.children, planes ) );
+            }
+            else {
+                for ( uint32_t j = 0; j < node.count; ++j ) {
+                    uint32_t o = order[node.first + j];
+                    if ( _clip( frustum, boxes[o], planes ) != Outside ) {
+                        hits.push_back( objects[o] );
+                    }
+                }
+            }
+        }
+    }
+
+    /// Append every object whose bounds overlap box to hits
+    void boxQuery( const BBox& box, std::vector<Node*>& hits ) const {
+        _query( hits,
+            [&]( const BBox& b ) { return overlaps( box, b ); },
+            [&]( const BBox& b ) { return encloses( box, b ); } );
+    }
+
+    static bool overlaps( const BBox& a, const BBox& b ) {
+        return a.ll.x <= b.ur.x && b.ll.x <= a.ur.x &&
+               a.ll.y <= b.ur.y && b.ll.y <= a.ur.y &&
+               a.ll.z <= b.ur.z && b.ll.z <= a.ur.z;
+    }
+
+    /// True if b lies entirely inside a
+    static bool encloses( const BBox& a, const BBox& b ) {
+        return a.ll.x <= b.ll.x && b.ur.x <= a.ur.x &&
+               a.ll.y <= b.ll.y && b.ur.y <= a.ur.y &&
+               a.ll.z <= b.ll.z && b.ur.z <= a.ur.z;
+    }
+
+    /// A ray, with its direction's reciprocal for slab tests
+    struct Ray {
+        vec3  origin;
+        vec3  inverse;
+
+        Ray( const vec3& origin, const vec3& dir ) : origin(origin),
+            inverse( 1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z ) {}
+
+        /// True if the ray enters b before limit; entry is set to the
+        ///   distance, 0 if origin is inside
+        bool intersects( const BBox& b, GLfloat limit, GLfloat& entry ) const {
+            GLfloat t0 = 0.0f, t1 = limit;
+            for ( int i = 0; i < 3; ++i ) {
+                GLfloat a = (b.ll[i] - origin[i]) * inverse[i];
+                GLfloat c = (b.ur[i] - origin[i]) * inverse[i];
+                if ( a > c ) { std::swap( a, c ); }
+                t0 = a > t0 ? a : t0;
+                t1 = c < t1 ? c : t1;
+                if ( t0 > t1 ) { return false; }
+            }
+            entry = t0;
+            return true;
+        }
+    };
+
+  private:
+    std::vector<vec3>  centers;  // object box centers, during build()
+
+    // Gathers the objects and transforms in scene graph order
+    struct Collector : public StaticTraversal<Collector> {
+        BVH&  bvh;
+        int   current;  // index of the enclosing transform
+
+        Collector( BVH& bvh ) : bvh(bvh), current(-1) {}
+
+        using StaticTraversal<Collector>::visit;
+
+        void visit( GeometricObject* node ) { _add( node ); }
+        void visit( LOD* node ) { _add( node ); }
+
+        void visit( Transform* node ) {
+            int parent = current;
+            bvh.transforms.push_back( node );
+            bvh.parents.push_back( parent );
+            bvh.worlds.push_back( mat4() );
+            current = int( bvh.transforms.size() ) - 1;
+            for ( auto n : node->nodes ) {
+                visitNode( n );
+            }
+            current = parent;
+        }
+
+        void _add( Node* node ) {
+            BBox b;
+            if ( !node->bounds( b ) ) { return; }
+            bvh.objects.push_back( node );
+            bvh.owner.push_back( current );
+            bvh.boxes.push_back( b );
+        }
+    };
+
+    static GLfloat _area( const BBox& b ) {
+        vec3 d = b.ur - b.ll;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // Make nodes[index] the root of a subtree over order[first, first +
+    //   count), splitting on another thread while depth remains
+    void _build( uint32_t index, uint32_t first, uint32_t count, int depth,
+                 std::atomic<uint32_t>& used ) {
+        BVHNode& node = nodes[index];
+        node.box = boxes[order[first]];
+        BBox centroids( centers[order[first]], centers[order[first]] );
+        for ( uint32_t i = first + 1; i < first + count; ++i ) {
+            node.box = node.box.merge( boxes[order[i]] );
+            vec3 c = centers[order[i]];
+            centroids = centroids.merge( BBox( c, c ) );
+        }
+
+        node.first = first;
+        node.count = count;
+        node.children = 0;
+        uint32_t split = _split( node, centroids, first, count );
+        if ( split == 0 ) { return; }
+
+        uint32_t children = used.fetch_add( 2 );
+        node.children = children;
+
+        if ( depth > 0 && count >= grain ) {
+            std::thread left( [this, children, first, split, depth, &used]() {
+                _build( children, first, split, depth - 1, used );
+            } );
+            _build( children + 1, first + split, count - split, depth - 1,
+                    used );
+            left.join();
+        }
+        else {
+            _build( children, first, split, 0, used );
+            _build( children + 1, first + split, count - split, 0, used );
+        }
+    }
+
+    // Partition order[first, first + count) by the cheapest SAH split and
+    //   return the size of the first part, or 0 to make node a leaf
+    uint32_t _split( const BVHNode& node, const BBox& centroids,
+                     uint32_t first, uint32_t count ) {
+        if ( count == 1 ) { return 0; }
+
+        // cost of a leaf, and of a split, in units of one box test
+        GLfloat leafCost = GLfloat( count );
+        GLfloat bestCost = std::numeric_limits<GLfloat>::infinity();
+        int bestAxis = -1, bestBin = 0;
+        GLfloat area = _area( node.box );
+
+        for ( int axis = 0; axis < 3; ++axis ) {
+            GLfloat lo = centroids.ll[axis];
+            GLfloat extent = centroids.ur[axis] - lo;
+            if ( extent <= 0.0f ) { continue; }
+            GLfloat scale = Bins / extent;
+
+            BBox     bins[Bins];
+            uint32_t counts[Bins] = { 0 };
+            for ( uint32_t i = first; i < first + count; ++i ) {
+                int b = std::min( Bins - 1,
+                    int( (centers[order[i]][axis] - lo) * scale ) );
+                bins[b] = counts[b] ? bins[b].merge( boxes[order[i]] )
+                                    : boxes[order[i]];
+                ++counts[b];
+            }
+
+            // areas and counts of everything right of each boundary
+            GLfloat   rightArea[Bins];
+            uint32_t  rightCount[Bins];
+            BBox      right;
+            uint32_t  n = 0;
+            for ( int b = Bins - 1; b > 0; --b ) {
+                if ( counts[b] ) {
+                    right = n ? right.merge( bins[b] ) : bins[b];
+                    n += counts[b];
+                }
+                rightArea[b] = n ? _area( right ) : 0.0f;
+                rightCount[b] = n;
+            }
+
+            BBox      left;
+            n = 0;
+            for ( int b = 0; b < Bins - 1; ++b ) {
+                if ( counts[b] ) {
+                    left = n ? left.merge( bins[b] ) : bins[b];
+                    n += counts[b];
+                }
+                if ( n == 0 || rightCount[b + 1] == 0 ) { continue; }
+
+                GLfloat cost = 1.0f + (_area( left ) * n +
+                    rightArea[b + 1] * rightCount[b + 1]) / area;
+                if ( cost < bestCost ) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        if ( bestAxis < 0 ) {
+            // every center coincides; halve the range if it's too big
+            return count > MaxLeafSize ? count / 2 : 0;
+        }
+        if ( count <= MaxLeafSize && leafCost <= bestCost ) { return 0; }
+
+        GLfloat lo = centroids.ll[bestAxis];
+        GLfloat scale = Bins / (centroids.ur[bestAxis] - lo);
+        auto middle = std::partition( order.begin() + first,
+            order.begin() + first + count, [&]( uint32_t o ) {
+                int b = std::min( Bins - 1,
+                    int( (centers[o][bestAxis] - lo) * scale ) );
+                return b <= bestBin;
+            } );
+        return uint32_t( middle - (order.begin() + first) );
+    }
+
+    // Append the objects of every leaf reached through boxes passing
+    //   test; a box passing inside has its whole subtree appended untested
+    template <typename Test, typename Inside>
+    void _query( std::vector<Node*>& hits, Test test, Inside inside ) const {
+        if ( nodes.empty() ) { return; }
+
+        std::vector<uint32_t> stack;
+        stack.reserve( 64 );
+        stack.push_back( 0 );
+        while ( !stack.empty() ) {
+            const BVHNode& node = nodes[stack.back()];
+            stack.pop_back();
+            if ( !test( node.box ) ) { continue; }
+
+            if ( inside( node.box ) ) {
+                _appendAll( node, hits );
+            }
+            else if ( node.children ) {
+                stack.push_back( node.children + 1 );
+                stack.push_back( node.children );
+            }
+            else {
+                for ( uint32_t j = 0; j < node.count; ++j ) {
+                    uint32_t o = order[node.first + j];
+                    if ( test( boxes[o] ) ) { hits.push_back( objects[o] ); }
+                }
+            }
+        }
+    }
+
+    // A subtree's objects are one range of order
+    void _appendAll( const BVHNode& node, std::vector<Node*>& hits ) const {
+        for ( uint32_t j = 0; j < node.count; ++j ) {
+            hits.push_back( objects[order[node.first + j]] );
+        }
+    }
+
+    static const unsigned Outside = ~0u;
+
+    // Test b against the frustum planes in mask, returning Outside if it
+    //   is wholly outside one, or else the planes it straddles
+    static unsigned _clip( const ViewFrustum& frustum, const BBox& b,
+                           unsigned mask ) {
+        unsigned straddled = 0;
+        for ( int i = 0; i < 6; ++i ) {
+            if ( !(mask & (1 << i)) ) { continue; }
+            const Angel::vec4& p = frustum.planes[i];
+
+            // the corners furthest along and against the plane normal
+            GLfloat ahead = p.x * (p.x > 0.0f ? b.ur.x : b.ll.x) +
+                          p.y * (p.y > 0.0f ? b.ur.y : b.ll.y) +
+                          p.z * (p.z > 0.0f ? b.ur.z : b.ll.z) + p.w;
+            if ( ahead < 0.0f ) { return Outside; }
+
+            GLfloat behind = p.x * (p.x > 0.0f ? b.ll.x : b.ur.x) +
+                           p.y * (p.y > 0.0f ? b.ll.y : b.ur.y) +
+                           p.z * (p.z > 0.0f ? b.ll.z : b.ur.z) + p.w;
+            if ( behind < 0.0f ) { straddled |= 1 << i; }
+        }
+        return straddled;
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __BVH_H__
@@ -0,0 +1,21 @@
+#version 410
+
+// default.vert for StaticBatches: each vertex names its model-view matrix,
+// which is read from the rows stored in the matrices buffer texture
+layout(std140, row_major) uniform Frame { mat4 P; };
+uniform samplerBuffer matrices;
+out vec2 fTexCoord;
+out vec3 fragmentColor;
+layout(location = 0) in vec4 vPosition;
+
+layout(location = 2) in vec2 vTexCoord;
+layout(location = 7) in int vMatrix;
+void main()
+{
+	int row = 4 * vMatrix;
+	mat4 MV = transpose(mat4(texelFetch(matrices, row),
+		texelFetch(matrices, row + 1), texelFetch(matrices, row + 2),
+		texelFetch(matrices, row + 3)));
+	gl_Position = P * MV * vPosition;
+	fTexCoord = vTexCoord;
+}
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Benchmark.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- Stopwatch ---
+//
+/// \class Stopwatch
+/// \brief Wall-clock timer reporting elapsed time in milliseconds
+
+struct Stopwatch {
+
+    typedef std::chrono::high_resolution_clock  Clock;
+
+    Clock::time_point  start;
+
+    Stopwatch() : start( Clock::now() ) {}
+
+    void reset()
+        { start = Clock::now(); }
+
+    /// Milliseconds since construction or the last reset()
+    double elapsed() const {
+        return std::chrono::duration<double, std::milli>(
+            Clock::now() - start ).count();
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+//  --- Samples ---
+//
+/// \class Samples
+/// \brief A named series of measurements with summary statistics
+
+struct Samples {
+
+    std::string          name;
+    std::string          units;
+    std::vector<double>  values;
+
+    Samples( const std::string& name, const std::string& units = "ms" ) :
+        name(name), units(units), values() {}
+
+    void add( double value )
+        { values.push_back( value ); }
+
+    double mean() const {
+        double sum = 0.0;
+        for ( auto v : values ) { sum += v; }
+        return values.empty() ? 0.0 : sum / values.size();
+    }
+
+    /// Return the p-th percentile (0 <= p <= 100) using nearest rank
+    double percentile( double p ) const {
+        if ( values.empty() ) { return 0.0; }
+
+        std::vector<double> sorted( values );
+        std::sort( sorted.begin(), sorted.end() );
+
+        size_t rank = size_t( p / 100.0 * (sorted.size() - 1) + 0.5 );
+        return sorted[std::min( rank, sorted.size() - 1 )];
+    }
+
+    friend std::ostream& operator << ( std::ostream& os, const Samples& s ) {
+        return os << std::left << std::setw(12) << s.name << std::right
+                  << std::fixed << std::setprecision(3)
+                  << "  mean " << std::setw(9) << s.mean()
+                  << "  p50 " << std::setw(9) << s.percentile( 50 )
+                  << "  p99 " << std::setw(9) << s.percentile( 99 )
+                  << "  (" << s.units << ")";
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+//  --- FrameTimings ---
+//
+/// \class FrameTimings
+/// \brief Per-frame timings collected by the headless benchmark harness
+/// \details traverse is the CPU time spent inside RenderTraversal::traverse,
+///    submit is the time glFinish() blocks waiting for the GL to drain the
+///    commands issued during the traversal, and frame is the total of both
+///    (including the clear).  Any other per-frame quantity (bytes streamed,
+///    draw calls, ...) is recorded in a named counter.
+
+struct FrameTimings {
+
+    Samples               traverse;
+    Samples               submit;
+    Samples               frame;
+    std::vector<Samples>  counters;
+
+    FrameTimings() :
+        traverse( "traverse" ), submit( "gl submit" ), frame( "frame" ),
+        counters() {}
+
+    /// Return the counter with the given name, creating it on first use
+    Samples& counter( const std::string& name,
+                      const std::string& units = "count" ) {
+        for ( auto& c : counters ) {
+            if ( c.name == name ) { return c; }
+        }
+        counters.push_back( Samples( name, units ) );
+        return counters.back();
+    }
+
+    void report( std::ostream& os ) const {
+        os << "frames: " << frame.values.size() << std::endl
+           << traverse << std::endl
+           << submit << std::endl
+           << frame << std::endl;
+        for ( auto& c : counters ) {
+            os << c << std::endl;
+        }
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __BENCHMARK_H__
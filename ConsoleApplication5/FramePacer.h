@@ -0,0 +1,174 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- FramePacer.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FRAMEPACER_H__
+#define __FRAMEPACER_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "Benchmark.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- FramePacer ---
+//
+/// \class FramePacer
+/// \brief Paces an interactive loop to a target frame rate by sleeping,
+///    and measures how steadily frames arrive
+/// \details The idle callback calls wait(), which sleeps until the next
+///    frame is due (targetFps frames a second, or at once when targetFps
+///    is 0) and returns the seconds since the previous wait(), for
+///    advancing animation by time rather than by frame.  Most of the wait
+///    is an OS sleep; only the last SpinMicroseconds are spent yielding,
+///    since a sleep can overshoot by a scheduler tick.  Deadlines follow
+///    on from each other, so one late frame doesn't make the next ones
+///    early, but a frame later than a whole period restarts the schedule
+///    rather than bursting to catch up.
+///
+///    onDemand is for the caller: it means frames should be drawn only
+///    when something has changed, and the loop should stop calling wait()
+///    (unregister the idle callback) when nothing will.  Call restart()
+///    when it resumes, so the pause isn't counted as animation time.
+///
+///    The display callback brackets each frame with beginFrame() and
+///    endFrame(), which collect the interval between frames and the time
+///    spent drawing each.  With reportSeconds set, endFrame() prints the
+///    summary that often; report() prints it on demand.
+
+struct FramePacer {
+
+    typedef std::chrono::steady_clock  Clock;
+
+    static const int  SpinMicroseconds = 1000;  /// spent yielding, not
+                                                ///   asleep, before a frame
+    static const int  MaxStepMillis = 100;      /// longest step wait()
+                                                ///   returns
+
+    double   targetFps;      /// frames per second, or 0 for no limit
+    bool     onDemand;       /// draw only when something has changed
+    double   reportSeconds;  /// seconds between reports, or 0 for none
+    Samples  intervals;      /// milliseconds between frames begun
+    Samples  drawTimes;      /// milliseconds spent drawing each frame
+
+    FramePacer( double targetFps = 60.0 ) : targetFps(targetFps),
+        onDemand(false), reportSeconds(0.0), intervals( "interval" ),
+        drawTimes( "draw" ), lastWait( Clock::now() ),
+        deadline( lastWait ), lastFrame(), frameStart(),
+        lastReport( lastWait ), framing(false) {}
+
+    /// Sleep until the next frame is due, returning the seconds since the
+    ///   last wait() (or restart()), at most MaxStepMillis
+    double wait() {
+        if ( targetFps > 0.0 ) {
+            Clock::duration period =
+                std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>( 1.0 / targetFps ) );
+            Clock::duration spin =
+                std::chrono::microseconds( SpinMicroseconds );
+
+            deadline += period;
+            Clock::time_point now = Clock::now();
+            if ( deadline < now - period ) { deadline = now; }
+
+            if ( deadline - now > spin ) {
+                std::this_thread::sleep_until( deadline - spin );
+            }
+            while ( Clock::now() < deadline ) { std::this_thread::yield(); }
+        }
+
+        Clock::time_point now = Clock::now();
+        double seconds =
+            std::chrono::duration<double>( now - lastWait ).count();
+        lastWait = now;
+        return std::min( seconds, MaxStepMillis / 1000.0 );
+    }
+
+    /// Start a new schedule from now, after the loop stopped calling wait()
+    void restart() {
+        lastWait = deadline = Clock::now();
+        framing = false;
+    }
+
+    void beginFrame() {
+        frameStart = Clock::now();
+        if ( framing ) { intervals.add( _millis( lastFrame, frameStart ) ); }
+        lastFrame = frameStart;
+        framing = true;
+    }
+
+    void endFrame() {
+        Clock::time_point now = Clock::now();
+        drawTimes.add( _millis( frameStart, now ) );
+
+        if ( reportSeconds > 0.0 &&
+             std::chrono::duration<double>( now - lastReport ).count() >=
+                 reportSeconds ) {
+            report( std::cout );
+        }
+    }
+
+    /// Print the frame rate and the spread of frame intervals and draw
+    ///   times since the last report, then start collecting afresh.  A
+    ///   frame is late when it began over half a period after it was due.
+    ///   The stream's format flags and precision are left as they were.
+    void report( std::ostream& os ) {
+        Clock::time_point now = Clock::now();
+        double seconds =
+            std::chrono::duration<double>( now - lastReport ).count();
+
+        double mean = intervals.mean(), variance = 0.0;
+        size_t late = 0;
+        for ( auto v : intervals.values ) {
+            variance += (v - mean) * (v - mean);
+            if ( targetFps > 0.0 && v > 1500.0 / targetFps ) { ++late; }
+        }
+        if ( !intervals.values.empty() ) {
+            variance /= intervals.values.size();
+        }
+
+        std::ios::fmtflags flags = os.flags();
+        std::streamsize precision = os.precision();
+        os << "frames: " << drawTimes.values.size() << " in " << std::fixed
+           << std::setprecision(1) << seconds << " s ("
+           << drawTimes.values.size() / std::max( seconds, 1e-3 )
+           << " fps, target ";
+        if ( targetFps > 0.0 ) { os << targetFps; } else { os << "none"; }
+        os << ( onDemand ? ", on demand" : "" ) << ")" << std::endl
+           << intervals << "  stddev " << std::setprecision(3)
+           << std::sqrt( variance ) << "  late " << late << std::endl
+           << drawTimes << std::endl;
+        os.flags( flags );
+        os.precision( precision );
+
+        intervals.values.clear();
+        drawTimes.values.clear();
+        lastReport = now;
+    }
+
+  private:
+    Clock::time_point  lastWait;    // return from the last wait()
+    Clock::time_point  deadline;    // when the last frame was due
+    Clock::time_point  lastFrame;   // the last beginFrame()
+    Clock::time_point  frameStart;  // the current frame's beginFrame()
+    Clock::time_point  lastReport;
+    bool               framing;     // lastFrame is part of this schedule
+
+    static double _millis( Clock::time_point from, Clock::time_point to ) {
+        return std::chrono::duration<double, std::milli>( to - from ).count();
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __FRAMEPACER_H__
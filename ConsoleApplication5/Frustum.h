@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Frustum.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FRUSTUM_H__
+#define __FRUSTUM_H__
+
+#include "Angel.h"
+#include "BBox.h"
+
+//----------------------------------------------------------------------------
+//
+//  --- ViewFrustum ---
+//
+/// \class ViewFrustum
+/// \brief The six clipping planes of a view volume
+/// \details The planes are extracted from a combined projection and
+///    model-view matrix (P * MV), and so are expressed in the coordinate
+///    frame MV maps from.  Each plane (a, b, c, d) has the inside of the
+///    volume where ax + by + cz + d >= 0.
+
+struct ViewFrustum {
+
+    typedef Angel::vec4  vec4;
+    typedef Angel::mat4  mat4;
+
+    vec4  planes[6];  ///< left, right, bottom, top, near, far
+
+    ViewFrustum() {}
+
+    ViewFrustum( const mat4& clip ) {
+        planes[0] = clip[3] + clip[0];
+        planes[1] = clip[3] - clip[0];
+        planes[2] = clip[3] + clip[1];
+        planes[3] = clip[3] - clip[1];
+        planes[4] = clip[3] + clip[2];
+        planes[5] = clip[3] - clip[2];
+    }
+
+    /// Return false only if the box is entirely outside one of the planes.
+    ///   Boxes near a corner of the frustum may be reported as visible.
+    bool intersects( const BBox& b ) const {
+        for ( int i = 0; i < 6; ++i ) {
+            const vec4& p = planes[i];
+
+            // the corner of the box furthest along the plane normal
+            GLfloat x = p.x > 0.0f ? b.ur.x : b.ll.x;
+            GLfloat y = p.y > 0.0f ? b.ur.y : b.ll.y;
+            GLfloat z = p.z > 0.0f ? b.ur.z : b.ll.z;
+
+            if ( p.x*x + p.y*y + p.z*z + p.w < 0.0f ) { return false; }
+        }
+        return true;
+    }
+
+    /// Return true if the box lies entirely inside every plane
+    bool contains( const BBox& b ) const {
+        for ( int i = 0; i < 6; ++i ) {
+            const vec4& p = planes[i];
+
+            // the corner of the box furthest against the plane normal
+            GLfloat x = p.x > 0.0f ? b.ll.x : b.ur.x;
+            GLfloat y = p.y > 0.0f ? b.ll.y : b.ur.y;
+            GLfloat z = p.z > 0.0f ? b.ll.z : b.ur.z;
+
+            if ( p.x*x + p.y*y + p.z*z + p.w < 0.0f ) { return false; }
+        }
+        return true;
+    }
+};
+
+#endif // __FRUSTUM_H__
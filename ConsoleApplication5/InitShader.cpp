@@ -1,4 +1,10 @@
 
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
 #include "Angel.h"
 
 namespace Angel {
@@ -20,7 +26,7 @@ readShaderSource(const char* shaderFile)
     long size = ftell(fp);
 
     fseek(fp, 0L, SEEK_SET);
-    char* buf = new char[size];
+    char* buf = new char[size + 1];
     fread(buf, 1, size, fp);
 
     buf[size] = '\0';
@@ -30,55 +36,63 @@ readShaderSource(const char* shaderFile)
 }
 
 
-// Create a GLSL program object from vertex and fragment shader files
-GLuint
-InitShader(const char* vShaderFile, const char* fShaderFile)
+// Read a shader file, exiting if it can't be read
+static char*
+requireShaderSource(const char* shaderFile)
 {
-    struct Shader {
-        const char*  filename;
-        GLenum       type;
-        GLchar*      source;
-    }  shaders[2] = {
-        { vShaderFile, GL_VERTEX_SHADER, NULL },
-        { fShaderFile, GL_FRAGMENT_SHADER, NULL }
-    };
-	std::cout << vShaderFile << std::endl;
-	printf(fShaderFile);
-    GLuint program = glCreateProgram();
-    
-    for ( int i = 0; i < 2; ++i ) {
-        Shader& s = shaders[i];
-        s.source = readShaderSource( s.filename );
-        if ( shaders[i].source == NULL ) {
-            std::cerr << "Failed to read " << s.filename << std::endl;
-            exit( EXIT_FAILURE );
-        }
+    char* source = readShaderSource( shaderFile );
+    if ( source == NULL ) {
+        std::cerr << "Failed to read " << shaderFile << std::endl;
+        exit( EXIT_FAILURE );
+    }
+    return source;
+}
 
-        GLuint shader = glCreateShader( s.type );
-        glShaderSource( shader, 1, (const GLchar**) &s.source, NULL );
-        glCompileShader( shader );
-
-        GLint  compiled;
-        glGetShaderiv( shader, GL_COMPILE_STATUS, &compiled );
-        if ( !compiled ) {
-            std::cerr << s.filename << " failed to compile:" << std::endl;
-            GLint  logSize;
-            glGetShaderiv( shader, GL_INFO_LOG_LENGTH, &logSize );
-            char* logMsg = new char[logSize];
-            glGetShaderInfoLog( shader, logSize, NULL, logMsg );
-            std::cerr << logMsg << std::endl;
-            delete [] logMsg;
-			system("PAUSE");
-            exit( EXIT_FAILURE );
-        }
 
-        //delete [] s.source;
+// 64-bit FNV-1a hash of a NULL-terminated string, continuing from hash
+static unsigned long long
+hashSource( const char* source,
+            unsigned long long hash = 14695981039346656037ULL )
+{
+    for ( ; source && *source; ++source ) {
+        hash ^= (unsigned char) *source;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-        glAttachShader( program, shader );
-        glDeleteShader( shader );
+
+// Compile source, read from filename, and attach it to program
+static void
+attachShader( GLuint program, const char* filename, const GLchar* source,
+              GLenum type )
+{
+    GLuint shader = glCreateShader( type );
+    glShaderSource( shader, 1, (const GLchar**) &source, NULL );
+    glCompileShader( shader );
+
+    GLint  compiled;
+    glGetShaderiv( shader, GL_COMPILE_STATUS, &compiled );
+    if ( !compiled ) {
+        std::cerr << filename << " failed to compile:" << std::endl;
+        GLint  logSize;
+        glGetShaderiv( shader, GL_INFO_LOG_LENGTH, &logSize );
+        char* logMsg = new char[logSize];
+        glGetShaderInfoLog( shader, logSize, NULL, logMsg );
+        std::cerr << logMsg << std::endl;
+        delete [] logMsg;
+		system("PAUSE");
+        exit( EXIT_FAILURE );
     }
 
-    /* link  and error check */
+    glAttachShader( program, shader );
+    glDeleteShader( shader );
+}
+
+// Link program and exit with the info log if linking fails
+static void
+linkProgram( GLuint program )
+{
     glLinkProgram(program);
 
     GLint  linked;
@@ -94,6 +108,199 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 		
         exit( EXIT_FAILURE );
     }
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- Program binary cache ---
+//
+//  Linked programs are saved with glGetProgramBinary to a file named by a
+//    hash of the driver strings and shader sources.  The file repeats the
+//    full key, and a binary is only used if the key matches and the driver
+//    accepts it, so a driver update or shader edit falls back to compiling.
+//
+
+static std::string  binaryCacheDirectory;   // empty when disabled
+
+void
+SetProgramBinaryCache(const char* directory)
+{
+    binaryCacheDirectory = directory ? directory : "";
+}
+
+static bool
+binaryCacheEnabled()
+{
+    return !binaryCacheDirectory.empty() && GLEW_ARB_get_program_binary;
+}
+
+// Build the cache key for a shader pair, and the file it is stored in
+static std::string
+binaryCacheKey( const char* vSource, const char* fSource, std::string& path )
+{
+    std::ostringstream key;
+    key << glGetString( GL_VENDOR ) << '\n'
+        << glGetString( GL_RENDERER ) << '\n'
+        << glGetString( GL_VERSION ) << '\n'
+        << std::hex << hashSource( fSource, hashSource( vSource ) );
+
+    std::ostringstream file;
+    file << binaryCacheDirectory << std::hex
+         << hashSource( key.str().c_str() ) << ".glbin";
+    path = file.str();
+
+    return key.str();
+}
+
+// Create a program from a cached binary, returning 0 on any mismatch
+static GLuint
+loadProgramBinary( const std::string& path, const std::string& key )
+{
+    std::ifstream in( path.c_str(), std::ios::binary | std::ios::ate );
+    if ( !in ) { return 0; }
+    std::streamoff fileSize = in.tellg();
+    in.seekg( 0 );
+
+    GLuint  keySize = 0;
+    GLenum  format = 0;
+    GLsizei length = 0;
+
+    // check each size against the file before allocating for it, so a
+    //   truncated or corrupt file is rejected rather than exhausting memory
+    in.read( (char*) &keySize, sizeof(keySize) );
+    if ( !in || keySize != key.size() ) { return 0; }
+
+    std::string fileKey( keySize, '\0' );
+    in.read( &fileKey[0], keySize );
+    in.read( (char*) &format, sizeof(format) );
+    in.read( (char*) &length, sizeof(length) );
+    if ( !in || fileKey != key || length <= 0 ||
+         length > fileSize - std::streamoff( in.tellg() ) ) {
+        return 0;
+    }
+
+    std::vector<char> binary( length );
+    if ( !in.read( &binary[0], length ) ) { return 0; }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary( program, format, &binary[0], length );
+
+    GLint  linked;
+    glGetProgramiv( program, GL_LINK_STATUS, &linked );
+    if ( !linked ) {
+        glDeleteProgram( program );
+        return 0;
+    }
+
+    return program;
+}
+
+// Save a linked program's binary; failures just leave the cache cold
+static void
+saveProgramBinary( GLuint program, const std::string& path,
+                   const std::string& key )
+{
+    GLint  length = 0;
+    glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+    if ( length <= 0 ) { return; }
+
+    std::vector<char> binary( length );
+    GLenum format = 0;
+    glGetProgramBinary( program, length, NULL, &format, &binary[0] );
+
+    std::ofstream out( path.c_str(), std::ios::binary | std::ios::trunc );
+    GLuint keySize = GLuint( key.size() );
+    out.write( (const char*) &keySize, sizeof(keySize) );
+    out.write( key.data(), keySize );
+    out.write( (const char*) &format, sizeof(format) );
+    out.write( (const char*) &length, sizeof(length) );
+    out.write( &binary[0], length );
+}
+
+
+// Bind the program's Frame and Object uniform blocks, if it has them, to
+//   their shared binding points.  Bindings aren't kept in program binaries,
+//   so this follows linking and loading alike.
+static void
+bindUniformBlocks( GLuint program )
+{
+    GLuint frame = glGetUniformBlockIndex( program, "Frame" );
+    if ( frame != GL_INVALID_INDEX ) {
+        glUniformBlockBinding( program, frame, FrameBlockBinding );
+    }
+
+    GLuint object = glGetUniformBlockIndex( program, "Object" );
+    if ( object != GL_INVALID_INDEX ) {
+        glUniformBlockBinding( program, object, ObjectBlockBinding );
+    }
+}
+
+
+// Create a GLSL program object from shader sources already read from
+//   vShaderFile and fShaderFile, through the binary cache when enabled
+static GLuint
+buildProgram( const char* vShaderFile, const char* vSource,
+              const char* fShaderFile, const char* fSource )
+{
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now();
+
+    bool         cached = binaryCacheEnabled();
+    std::string  path, key;
+    GLuint       program = 0;
+
+    if ( cached ) {
+        key = binaryCacheKey( vSource, fSource, path );
+        program = loadProgramBinary( path, key );
+    }
+
+    bool hit = program != 0;
+    if ( !hit ) {
+        program = glCreateProgram();
+    
+        attachShader( program, vShaderFile, vSource, GL_VERTEX_SHADER );
+        attachShader( program, fShaderFile, fSource, GL_FRAGMENT_SHADER );
+
+        if ( cached ) {
+            glProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                 GL_TRUE );
+        }
+
+        /* link  and error check */
+        linkProgram( program );
+
+        if ( cached ) { saveProgramBinary( program, path, key ); }
+    }
+
+    bindUniformBlocks( program );
+
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start ).count();
+    std::cout << std::endl << "InitShader: " << ms << " ms"
+              << ( !cached ? "" : hit ? " (binary cache hit)"
+                                      : " (binary cache miss)" )
+              << std::endl;
+
+    return program;
+}
+
+
+// Create a GLSL program object from vertex and fragment shader files
+GLuint
+InitShader(const char* vShaderFile, const char* fShaderFile)
+{
+	std::cout << vShaderFile << std::endl;
+	printf(fShaderFile);
+
+    char* vSource = requireShaderSource( vShaderFile );
+    char* fSource = requireShaderSource( fShaderFile );
+
+    GLuint program = buildProgram( vShaderFile, vSource, fShaderFile,
+                                   fSource );
+
+    delete [] vSource;
+    delete [] fSource;
 
     /* use program object */
     
@@ -101,4 +308,115 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
     return program;
 }
 
+
+// Create a vertex-shader-only GLSL program whose outputs named in varyings
+//   are captured, interleaved, by transform feedback
+GLuint
+InitTransformFeedbackShader(const char* vShaderFile,
+                            const GLchar** varyings, GLsizei numVaryings)
+{
+    GLuint program = glCreateProgram();
+
+    char* source = requireShaderSource( vShaderFile );
+    attachShader( program, vShaderFile, source, GL_VERTEX_SHADER );
+    delete [] source;
+
+    glTransformFeedbackVaryings( program, numVaryings, varyings,
+                                 GL_INTERLEAVED_ATTRIBS );
+    linkProgram( program );
+
+    return program;
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- Shared program cache ---
+//
+//  Programs are keyed by their shader paths, so sharing a live program
+//    costs a map lookup: the files are read (and, for the binary cache,
+//    hashed) only when no live program was built from them.  An edited
+//    shader is picked up once every holder of the old program releases it.
+//
+
+struct CachedProgram {
+    GLuint       program;
+    int          references;
+    std::string  vShaderFile;
+    std::string  fShaderFile;
+};
+
+typedef std::map<std::string, CachedProgram>  ProgramCache;
+
+static ProgramCache  programCache;
+static int           programsLinked = 0;
+static int           programsShared = 0;
+
+GLuint
+AcquireProgram(const char* vShaderFile, const char* fShaderFile)
+{
+    std::string key = std::string( vShaderFile ) + '\n' + fShaderFile;
+
+    ProgramCache::iterator it = programCache.find( key );
+    if ( it != programCache.end() ) {
+        ++it->second.references;
+        ++programsShared;
+        return it->second.program;
+    }
+
+    char* vSource = requireShaderSource( vShaderFile );
+    char* fSource = requireShaderSource( fShaderFile );
+
+    CachedProgram entry = { buildProgram( vShaderFile, vSource,
+                                          fShaderFile, fSource ),
+                            1, vShaderFile, fShaderFile };
+    programCache[key] = entry;
+    ++programsLinked;
+
+    delete [] vSource;
+    delete [] fSource;
+
+    return entry.program;
+}
+
+void
+ReleaseProgram(GLuint program)
+{
+    for ( ProgramCache::iterator it = programCache.begin();
+          it != programCache.end(); ++it ) {
+        if ( it->second.program == program ) {
+            if ( --it->second.references == 0 ) {
+                glDeleteProgram( program );
+                programCache.erase( it );
+            }
+            return;
+        }
+    }
+
+    // not from the cache, so the caller was its only owner
+    glDeleteProgram( program );
+}
+
+bool
+ProgramShaderFiles(GLuint program, const char*& vShaderFile,
+                   const char*& fShaderFile)
+{
+    for ( ProgramCache::iterator it = programCache.begin();
+          it != programCache.end(); ++it ) {
+        if ( it->second.program == program ) {
+            vShaderFile = it->second.vShaderFile.c_str();
+            fShaderFile = it->second.fShaderFile.c_str();
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+ProgramCacheCounts(int& linked, int& shared)
+{
+    linked = programsLinked;
+    shared = programsShared;
+}
+
 }  // Close namespace Angel block
@@ -0,0 +1,9 @@
+#version 410
+in vec4 fragmentColor;
+in vec2 fTexCoord;
+out vec4 color;
+
+void main()
+{
+	color = fragmentColor;
+}
@@ -0,0 +1,24 @@
+#version 410
+
+
+layout(std140, row_major) uniform Frame { mat4 P; };
+layout(std140, row_major) uniform Object { mat4 MV; };
+out vec2 fTexCoord;
+out vec4 fragmentColor;
+layout(location = 0) in vec4 vPosition;
+layout(location = 2) in vec2 vTexCoord;
+
+// per instance: the top three rows of the model matrix, and a color
+layout(location = 8) in vec4 instanceRow0;
+layout(location = 9) in vec4 instanceRow1;
+layout(location = 10) in vec4 instanceRow2;
+layout(location = 11) in vec4 instanceColor;
+void main()
+{
+	vec4 position = vec4(dot(instanceRow0, vPosition),
+		dot(instanceRow1, vPosition), dot(instanceRow2, vPosition),
+		vPosition.w);
+	gl_Position = P * MV * position;
+	fTexCoord = vTexCoord;
+	fragmentColor = instanceColor;
+}
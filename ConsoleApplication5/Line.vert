@@ -1,8 +1,8 @@
 #version 410
 
 
-uniform mat4 P;
-uniform mat4 MV;
+layout(std140, row_major) uniform Frame { mat4 P; };
+layout(std140, row_major) uniform Object { mat4 MV; };
 uniform vec3 center;
 out vec2 fTexCoord;
 out vec4 fragmentColor;
@@ -0,0 +1,20 @@
+#version 410
+
+// Transform feedback pass for the SphereLines particles: ages every
+// vertex color and re-ignites the quads listed in spawn[]
+const int MaxSpawn = 8;
+uniform int   numSpawn;
+uniform int   spawn[MaxSpawn];
+uniform float decay;
+layout(location = 0) in vec4 vColor;
+out vec4 tfColor;
+void main()
+{
+	int quad = gl_VertexID / 4;
+	tfColor = vec4(vColor.rgb, vColor.a - decay);
+	for (int i = 0; i < numSpawn; ++i)
+	{
+		if (spawn[i] == quad)
+			tfColor.a = 1.0;
+	}
+}
@@ -0,0 +1,162 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- MeshCache.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Angel.h"
+#include "BBox.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- SharedMesh ---
+//
+/// \class SharedMesh
+/// \brief The GL objects and sizes of a generated mesh, shared by every
+///    node built with the same parameters
+
+struct SharedMesh {
+    std::string           key;          /// shape type and parameters
+    GLuint                vbo;          /// vertex buffer
+    std::vector<GLuint>   buffers;      /// further vertex buffers, if any
+    GLuint                ebo;          /// element buffer, or 0
+    GLuint                texture;      /// 2D texture, or 0
+    GLsizei               numVertices;
+    BBox                  bbox;
+    std::vector<GLsizei>  counts;       /// further sizes the shape needs
+    GLsizeiptr            bytes;        /// GL memory held by the objects
+    GLsizeiptr            bufferBytes;  /// the part of it in vbo and ebo
+    unsigned              refs;         /// nodes using the mesh
+};
+
+//----------------------------------------------------------------------------
+//
+//  --- MeshCache ---
+//
+/// \class MeshCache
+/// \brief Procedural meshes keyed by shape type and parameters, so each is
+///    generated and uploaded once however many nodes use it
+/// \details A shape looks its key up with find() before generating
+///    anything.  On a miss it builds its buffers as before and hands them to
+///    add(); either way it holds a reference until release(), and the last
+///    release deletes the GL objects.  Like the program cache it is only
+///    used on the GL thread.  With enabled() cleared every lookup misses, so
+///    each node generates its own mesh, for comparison.
+
+struct MeshCache {
+
+    struct Counts {
+        size_t      meshes;     /// meshes alive
+        size_t      generated;  /// meshes ever added
+        size_t      hits;       /// lookups answered from the cache
+        GLsizeiptr  bytes;      /// GL memory held by the meshes alive
+        GLsizeiptr  buffers;    /// the part of it in vertex and element
+                                ///   buffers
+    };
+
+    /// Return the mesh cached under key with a new reference, or NULL
+    static SharedMesh* find( const std::string& key ) {
+        if ( !enabled() ) { return NULL; }
+
+        auto i = _meshes().find( key );
+        if ( i == _meshes().end() ) { return NULL; }
+
+        ++i->second->refs;
+        ++_counts().hits;
+        return i->second;
+    }
+
+    /// Cache a copy of mesh under mesh.key, with one reference
+    static SharedMesh* add( const SharedMesh& mesh ) {
+        SharedMesh* m = new SharedMesh( mesh );
+        m->refs = 1;
+        m->bufferBytes = _bufferSize( m->vbo ) + _bufferSize( m->ebo );
+        for ( auto b : m->buffers ) { m->bufferBytes += _bufferSize( b ); }
+        m->bytes = m->bufferBytes + _textureSize( m->texture );
+
+        Counts& c = _counts();
+        if ( !enabled() ) {
+            m->key += " #" + std::to_string( c.generated );  // never found
+        }
+        _meshes()[m->key] = m;
+
+        ++c.meshes;
+        ++c.generated;
+        c.bytes += m->bytes;
+        c.buffers += m->bufferBytes;
+        return m;
+    }
+
+    /// Drop a reference, deleting the mesh's GL objects with the last one
+    static void release( SharedMesh* m ) {
+        if ( --m->refs ) { return; }
+
+        glDeleteBuffers( 1, &m->vbo );
+        if ( !m->buffers.empty() ) {
+            glDeleteBuffers( GLsizei( m->buffers.size() ), &m->buffers[0] );
+        }
+        if ( m->ebo ) { glDeleteBuffers( 1, &m->ebo ); }
+        if ( m->texture ) { glDeleteTextures( 1, &m->texture ); }
+
+        Counts& c = _counts();
+        --c.meshes;
+        c.bytes -= m->bytes;
+        c.buffers -= m->bufferBytes;
+        _meshes().erase( m->key );
+        delete m;
+    }
+
+    static const Counts& counts()
+        { return _counts(); }
+
+    /// Share meshes between nodes (the default)
+    static bool& enabled() {
+        static bool  on = true;
+        return on;
+    }
+
+  private:
+    static std::map<std::string, SharedMesh*>& _meshes() {
+        static std::map<std::string, SharedMesh*>  meshes;
+        return meshes;
+    }
+
+    static Counts& _counts() {
+        static Counts  counts = { 0, 0, 0, 0, 0 };
+        return counts;
+    }
+
+    static GLsizeiptr _bufferSize( GLuint buffer ) {
+        if ( !buffer ) { return 0; }
+        GLint size = 0;
+        glBindBuffer( GL_COPY_READ_BUFFER, buffer );
+        glGetBufferParameteriv( GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size );
+        glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+        return size;
+    }
+
+    // RGB8 texels of level 0, as the shapes upload them
+    static GLsizeiptr _textureSize( GLuint texture ) {
+        if ( !texture ) { return 0; }
+        GLint width = 0, height = 0;
+        glBindTexture( GL_TEXTURE_2D, texture );
+        glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width );
+        glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT,
+                                  &height );
+        return GLsizeiptr( width ) * height * 3;
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __MESHCACHE_H__
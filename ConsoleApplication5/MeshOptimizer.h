@@ -0,0 +1,202 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- MeshOptimizer.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __MESHOPTIMIZER_H__
+#define __MESHOPTIMIZER_H__
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "Angel.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- Indexed mesh preparation ---
+//
+//  Helpers for turning generated geometry into an indexed triangle list
+//    that is cheap to draw: weldVertices() merges identical vertices,
+//    optimizeVertexCache() reorders the triangles so the GPU's
+//    post-transform cache rarely has to shade a vertex twice, and
+//    optimizeVertexFetch() renumbers the vertices in the order they are
+//    first drawn.  vertexCacheACMR() measures the result: the average
+//    number of vertices shaded per triangle, 0.5 at best for a large grid
+//    and 3 when nothing is reused.
+//
+//  The cache is modelled as a FIFO of CacheSize vertices, a conservative
+//    match for current hardware.
+//
+
+const int CacheSize = 16;
+
+/// Replace a triangle soup (every three vertices a triangle) by its
+///   distinct vertices, in order of first appearance, and indices into them
+template <typename Vertex>
+void weldVertices( std::vector<Vertex>& vertices,
+                   std::vector<GLuint>& indices )
+{
+    std::vector<Vertex>                                unique;
+    std::map< uint64_t, std::vector<GLuint> >          index;
+
+    indices.clear();
+    indices.reserve( vertices.size() );
+    for ( auto& v : vertices ) {
+        // 64-bit FNV-1a of the vertex's bytes
+        uint64_t hash = 14695981039346656037ull;
+        const unsigned char* p = (const unsigned char*) &v;
+        for ( size_t i = 0; i < sizeof(Vertex); ++i ) {
+            hash = (hash ^ p[i]) * 1099511628211ull;
+        }
+
+        std::vector<GLuint>& matches = index[hash];
+        GLuint found = GLuint( unique.size() );
+        for ( auto m : matches ) {
+            if ( memcmp( &unique[m], &v, sizeof(Vertex) ) == 0 ) {
+                found = m;
+                break;
+            }
+        }
+        if ( found == unique.size() ) {
+            matches.push_back( found );
+            unique.push_back( v );
+        }
+        indices.push_back( found );
+    }
+    vertices.swap( unique );
+}
+
+/// Average number of vertices a FIFO cache of cacheSize misses per
+///   triangle when drawing indices
+inline float vertexCacheACMR( const std::vector<GLuint>& indices,
+                              size_t numVertices,
+                              int cacheSize = CacheSize )
+{
+    if ( indices.size() < 3 ) { return 0.0; }
+
+    // a vertex is still cached if fewer than cacheSize misses have
+    //   happened since it went in
+    std::vector<long>  entered( numVertices, -1 );
+    long               misses = 0;
+    for ( auto v : indices ) {
+        if ( entered[v] < 0 || misses - entered[v] >= cacheSize ) {
+            entered[v] = misses++;
+        }
+    }
+    return float( misses ) / (indices.size() / 3);
+}
+
+/// Reorder the triangles of indices for a post-transform vertex cache of
+///   cacheSize, using Tipsify (Sander, Nehab and Barczak, "Fast Triangle
+///   Reordering for Vertex Locality and Reduced Overdraw", 2007): fan out
+///   around one vertex at a time, moving next to the emitted vertex that
+///   will still be in the cache and has the most triangles left.
+inline void optimizeVertexCache( std::vector<GLuint>& indices,
+                                 size_t numVertices,
+                                 int cacheSize = CacheSize )
+{
+    size_t numTriangles = indices.size() / 3;
+    if ( numTriangles == 0 ) { return; }
+
+    // triangles using each vertex
+    std::vector<GLuint>  offsets( numVertices + 1, 0 );
+    for ( auto v : indices ) { ++offsets[v + 1]; }
+    for ( size_t v = 0; v < numVertices; ++v ) { offsets[v + 1] += offsets[v]; }
+
+    std::vector<GLuint>  triangles( indices.size() );
+    std::vector<GLuint>  fill( offsets.begin(), offsets.end() - 1 );
+    for ( size_t i = 0; i < indices.size(); ++i ) {
+        triangles[fill[indices[i]]++] = GLuint( i / 3 );
+    }
+
+    std::vector<GLuint>         live( numVertices );  // unemitted triangles
+    for ( size_t v = 0; v < numVertices; ++v ) {
+        live[v] = offsets[v + 1] - offsets[v];
+    }
+    std::vector<long>           cached( numVertices, 0 );  // time entered
+    std::vector<unsigned char>  emitted( numTriangles, 0 );
+    std::vector<GLuint>         deadEnd;  // recent vertices, to fall back on
+    std::vector<GLuint>         output;
+    output.reserve( indices.size() );
+
+    long    time = cacheSize + 1;
+    size_t  cursor = 0;  // next vertex to try when the dead-end stack is dry
+    long    fan = indices[0];
+
+    while ( fan >= 0 ) {
+        std::vector<GLuint> candidates;
+        for ( GLuint i = offsets[fan]; i < offsets[fan + 1]; ++i ) {
+            GLuint t = triangles[i];
+            if ( emitted[t] ) { continue; }
+
+            for ( int k = 0; k < 3; ++k ) {
+                GLuint v = indices[3 * t + k];
+                output.push_back( v );
+                deadEnd.push_back( v );
+                candidates.push_back( v );
+                --live[v];
+                if ( time - cached[v] > cacheSize ) { cached[v] = time++; }
+            }
+            emitted[t] = 1;
+        }
+
+        // the candidate that will still be cached after its remaining
+        //   triangles are emitted, and has been in the cache longest
+        fan = -1;
+        long best = -1;
+        for ( auto v : candidates ) {
+            if ( !live[v] ) { continue; }
+            long priority = 0;
+            if ( time - cached[v] + 2 * long( live[v] ) <= cacheSize ) {
+                priority = time - cached[v];
+            }
+            if ( priority > best ) {
+                best = priority;
+                fan = v;
+            }
+        }
+
+        while ( fan < 0 && !deadEnd.empty() ) {
+            GLuint v = deadEnd.back();
+            deadEnd.pop_back();
+            if ( live[v] ) { fan = v; }
+        }
+        while ( fan < 0 && cursor < numVertices ) {
+            if ( live[cursor] ) { fan = long( cursor ); }
+            ++cursor;
+        }
+    }
+
+    indices.swap( output );
+}
+
+/// Renumber vertices in the order indices first uses them, so the vertex
+///   fetches of consecutive triangles are close together in memory
+template <typename Vertex>
+void optimizeVertexFetch( std::vector<Vertex>& vertices,
+                          std::vector<GLuint>& indices )
+{
+    const GLuint         unused = GLuint( -1 );
+    std::vector<GLuint>  remap( vertices.size(), unused );
+    std::vector<Vertex>  ordered;
+    ordered.reserve( vertices.size() );
+
+    for ( auto& v : indices ) {
+        if ( remap[v] == unused ) {
+            remap[v] = GLuint( ordered.size() );
+            ordered.push_back( vertices[v] );
+        }
+        v = remap[v];
+    }
+    vertices.swap( ordered );
+}
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __MESHOPTIMIZER_H__
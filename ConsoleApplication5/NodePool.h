@@ -0,0 +1,183 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- NodePool.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __NODEPOOL_H__
+#define __NODEPOOL_H__
+
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Scene {
+
+template <typename T> struct NodePool;
+
+//----------------------------------------------------------------------------
+//
+//  --- NodeHandle ---
+//
+/// \class NodeHandle
+/// \brief A reference to a node in a NodePool that knows when the node has
+///    been destroyed
+/// \details The handle converts to a T*, which is NULL once the node it
+///    named has been destroyed, even if its slot has been reused since.
+
+template <typename T>
+struct NodeHandle {
+
+    NodePool<T>*  pool;        /// pool holding the node, or NULL
+    unsigned      index;       /// slot in the pool
+    unsigned      generation;  /// slot generation when the node was created
+
+    NodeHandle() : pool(NULL), index(0), generation(0) {}
+    NodeHandle( NodePool<T>* pool, unsigned index, unsigned generation ) :
+        pool(pool), index(index), generation(generation) {}
+
+    T* get() const
+        { return pool ? pool->get( *this ) : NULL; }
+
+    operator T* () const
+        { return get(); }
+
+    T* operator -> () const
+        { return get(); }
+};
+
+//----------------------------------------------------------------------------
+//
+//  --- PoolBase ---
+//
+/// \class PoolBase
+/// \brief Type-erased interface that lets SceneGraph own pools of any node
+///    type
+
+struct PoolBase {
+    virtual ~PoolBase() {}
+
+    /// Destroy every live node
+    virtual void clear() = 0;
+
+    /// Number of live nodes
+    virtual size_t size() const = 0;
+};
+
+//----------------------------------------------------------------------------
+//
+//  --- NodePool ---
+//
+/// \class NodePool
+/// \brief Storage for nodes of a single type, allocated in fixed-size blocks
+/// \details Nodes of one type sit next to each other in blocks of
+///    BlockSize, which are never moved or freed until the pool is, so
+///    pointers to nodes stay valid for their lifetime.  Destroyed nodes'
+///    slots are reused, most recently freed first, with the slot's
+///    generation bumped so old handles to it return NULL.
+
+template <typename T>
+struct NodePool : public PoolBase {
+
+    static const unsigned BlockSize = 256;
+
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type
+        Storage;
+
+    NodePool() : blocks(), generations(), alive(), freeSlots(), live(0) {}
+
+    ~NodePool() {
+        clear();
+        for ( auto block : blocks ) { delete [] block; }
+    }
+
+    /// Construct a node from args in a free slot
+    template <typename... Args>
+    NodeHandle<T> create( Args&&... args ) {
+        unsigned index;
+        if ( freeSlots.empty() ) {
+            index = unsigned( alive.size() );
+            if ( index % BlockSize == 0 ) {
+                blocks.push_back( new Storage[BlockSize] );
+            }
+            generations.push_back( 0 );
+            alive.push_back( false );
+        }
+        else {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+
+        new ( _slot( index ) ) T( std::forward<Args>( args )... );
+        alive[index] = true;
+        ++live;
+        return NodeHandle<T>( this, index, generations[index] );
+    }
+
+    /// Return the node h names, or NULL if it has been destroyed
+    T* get( const NodeHandle<T>& h ) const {
+        if ( h.index >= alive.size() || !alive[h.index] ||
+             generations[h.index] != h.generation ) {
+            return NULL;
+        }
+        return _slot( h.index );
+    }
+
+    /// Destroy the node h names, if it is still alive.  The node must
+    ///   already have been removed from any Transform or SceneGraph;
+    ///   SceneGraph::destroy() sees to that.
+    void destroy( const NodeHandle<T>& h ) {
+        if ( get( h ) ) { _destroy( h.index ); }
+    }
+
+    virtual void clear() {
+        for ( unsigned i = 0; i < alive.size(); ++i ) {
+            if ( alive[i] ) { _destroy( i ); }
+        }
+    }
+
+    virtual size_t size() const
+        { return live; }
+
+    /// Call f on every live node, in storage order
+    template <typename F>
+    void forEach( F f ) {
+        const unsigned char* a = alive.data();
+        for ( size_t b = 0, first = 0; b < blocks.size();
+              ++b, first += BlockSize ) {
+            T* block = reinterpret_cast<T*>( blocks[b] );
+            size_t n = std::min<size_t>( BlockSize, alive.size() - first );
+            for ( size_t i = 0; i < n; ++i ) {
+                if ( a[first + i] ) { f( block + i ); }
+            }
+        }
+    }
+
+  private:
+    std::vector<Storage*>       blocks;       // BlockSize slots each
+    std::vector<unsigned>       generations;  // per slot
+    std::vector<unsigned char>  alive;        // per slot
+    std::vector<unsigned>       freeSlots;    // destroyed slots to reuse
+    size_t                      live;         // number of live nodes
+
+    T* _slot( unsigned index ) const {
+        return reinterpret_cast<T*>(
+            &blocks[index / BlockSize][index % BlockSize] );
+    }
+
+    void _destroy( unsigned index ) {
+        _slot( index )->~T();
+        alive[index] = false;
+        ++generations[index];
+        freeSlots.push_back( index );
+        --live;
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __NODEPOOL_H__
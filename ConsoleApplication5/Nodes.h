@@ -9,11 +9,15 @@
 
 
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <vector>
 #include "Angel.h"
 #include "BBox.h"
+#include "Frustum.h"
+#include "MeshCache.h"
 
 
 using namespace std;
@@ -26,14 +30,46 @@ namespace Scene {
 //
 ///  @class Node
 ///  @brief Base class for all nodes stored in the scene graph
+///  @details Each node records its concrete type, so traversals derived
+///    from StaticTraversal (see Traversals.h) can find it with a switch
+///    rather than a virtual call.  A new kind of node needs a NodeType, a
+///    case in dispatch() and, for Traversal, a receive().
 
 struct Traversal;  // Foward declaration of Traversal base class
 
+/// The concrete type of a node
+enum class NodeType {
+    GeometricObject, Cone, GroundPlane, Cube, Sphere, SphereLines,
+    InstancedGeometry, Mesh, Transform, LOD
+};
+
+/// Counter bumped whenever a node is added to, removed from or replaced in
+///   a scene graph, Transform or LOD, so structures derived from the graph
+///   (see RenderList) know when to rebuild.  Code that edits
+///   Transform::nodes or LOD::levels directly must bump it too.
+inline unsigned long& structureVersion()
+{
+    static unsigned long  version = 1;
+    return version;
+}
+
 struct Node {
-    Node() {}
+    NodeType  type;   /// set by the most derived constructor
+    unsigned  links;  /// Transforms, LODs and SceneGraphs holding the node
+
+    Node( NodeType type ) : type(type), links(0) {}
     virtual ~Node() {}
 
+    /// True for a GeometricObject or any shape derived from it
+    bool isGeometric() const
+        { return type != NodeType::Transform && type != NodeType::LOD; }
+
     virtual void receive( Traversal* ) = 0;
+
+    /// Set b to the node's bounds in its parent's coordinate frame, or
+    ///   return false if the node has no geometry
+    virtual bool bounds( BBox& /* b */ )
+        { return false; }
 };
 
 //----------------------------------------------------------------------------
@@ -45,6 +81,12 @@ struct Node {
 ///  @details The GeometricObject class is an object for managing an OpenGL
 ///    object that uses vertex array objects (VAOs), vertex buffer objects
 ///    (VBOs), and shader programs.
+///
+///    Shapes generated from parameters share their buffers and texture
+///    with every other node built from the same ones, through MeshCache:
+///    the constructor calls acquireMesh() with a key naming the shape and
+///    its parameters, and only on a miss generates the mesh and calls
+///    shareMesh().  Each node keeps its own vertex array object.
 
 struct GeometricObject : public Node {
 
@@ -53,30 +95,79 @@ struct GeometricObject : public Node {
     GLuint   vbo;      /// vertex buffer object handle
     GLsizei  numVertices;  /// number of vertices to be rendered
     GLuint   program;  /// Shader program handle
-    GLint    uP;       /// Shader projection transformation uniform location
-    GLint    uMV;      /// Shader model-view transformation uniform location
+    GLuint   texture;  /// 2D texture sampled by the program, or 0
+    bool     dynamic;  /// needs its visit every frame (e.g. to animate),
+                       ///   so it can't be compiled into a RenderList
+    SharedMesh*  shared;  /// cached mesh holding vbo and texture, or NULL
 
     GeometricObject( GLuint program ) :
-        Node(), bbox(), numVertices(0), program(program)
+        Node( NodeType::GeometricObject ), bbox(), numVertices(0),
+        program(program), texture(0), dynamic(false), shared(NULL)
         { _init(); }
                                         
     GeometricObject( const std::string& vertexShader = "C:\\Users\\Tanner\\Documents\\visual studio 2013\\Projects\\ConsoleApplication5\\ConsoleApplication5\\default.vert",
                      const std::string& fragmentShader = "C:\\Users\\Tanner\\Documents\\visual studio 2013\\Projects\\ConsoleApplication5\\ConsoleApplication5\\default.frag" ) :
-        Node(), bbox(), numVertices(0)
+        Node( NodeType::GeometricObject ), bbox(), numVertices(0),
+        texture(0), dynamic(false), shared(NULL)
         { 
-            program = Angel::InitShader( vertexShader.c_str(),
-                                         fragmentShader.c_str() );
+            program = Angel::AcquireProgram( vertexShader.c_str(),
+                                             fragmentShader.c_str() );
             _init();
         }
 
     virtual ~GeometricObject() {
         glDeleteVertexArrays( 1, &vao );
-        glDeleteBuffers( 1, &vbo );
-        glDeleteProgram( program );
+        if ( shared ) { MeshCache::release( shared ); }
+        else { glDeleteBuffers( 1, &vbo ); }
+        Angel::ReleaseProgram( program );
     }
 
     virtual void receive( Traversal* t );
 
+    /// Use the mesh cached under key in place of vbo, if there is one:
+    ///   its vertex and element buffers are bound to vao, left bound, and
+    ///   its texture, bounds and vertex count copied.  Returns false on a
+    ///   miss, after which the shape should build its mesh and shareMesh().
+    bool acquireMesh( const std::string& key ) {
+        SharedMesh* m = MeshCache::find( key );
+        if ( !m ) { return false; }
+
+        glDeleteBuffers( 1, &vbo );
+        shared = m;
+        vbo = m->vbo;
+        texture = m->texture;
+        numVertices = m->numVertices;
+        bbox = m->bbox;
+
+        glBindVertexArray( vao );
+        glBindBuffer( GL_ARRAY_BUFFER, vbo );
+        if ( m->ebo ) { glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m->ebo ); }
+        return true;
+    }
+
+    /// Cache the mesh just built in vbo, ebo and texture under key, with
+    ///   any sizes beyond numVertices the shape needs to draw it and any
+    ///   vertex buffers beyond vbo
+    void shareMesh( const std::string& key, GLuint ebo = 0,
+                    const std::vector<GLsizei>& counts =
+                        std::vector<GLsizei>(),
+                    const std::vector<GLuint>& buffers =
+                        std::vector<GLuint>() ) {
+        SharedMesh m;
+        m.key = key;
+        m.vbo = vbo;
+        m.buffers = buffers;
+        m.ebo = ebo;
+        m.texture = texture;
+        m.numVertices = numVertices;
+        m.bbox = bbox;
+        m.counts = counts;
+        shared = MeshCache::add( m );
+    }
+
+    virtual bool bounds( BBox& b )
+        { b = bbox; return true; }
+
   private:
     void _init() {
             glGenVertexArrays( 1, &vao );
@@ -84,9 +175,6 @@ struct GeometricObject : public Node {
 
             glGenBuffers( 1, &vbo );
             glBindBuffer( GL_ARRAY_BUFFER, vbo );
-
-            uP = glGetUniformLocation( program, "P" );
-            uMV = glGetUniformLocation( program, "MV" );
     }
 };
 
@@ -95,29 +183,318 @@ struct GeometricObject : public Node {
 // --- Transform ---
 //
 ///  @class Transform
-///  @brief 
-///  @details
+///  @brief A group of nodes sharing a transformation
+///  @details The union of the children's bounds is cached, both in the
+///    transform's own frame (contents) and in its parent's (box).  Call
+///    changed() after modifying xform; it marks this node and every
+///    ancestor so only the affected caches are rebuilt.
+///
+///    The model-view matrix for the children (world) is cached as well,
+///    stamped with the version of the parent matrix it was built from.
+///    updateWorld() only multiplies when xform has changed or the parent
+///    matrix carries a different version, so a modified transform
+///    recomputes its own subtree and nothing else.  changed() also flags
+///    the ancestors whose subtrees now hold a stale matrix, so a
+///    RenderList can skip whole subtrees that are current (see
+///    subtreeCurrent()).
 
 struct Transform : public Node {
 
     typedef Angel::mat4         mat4;
     typedef std::vector<Node*>  Nodes;
 
-    mat4   xform;
-    Nodes  nodes;
+    mat4           xform;
+    Nodes          nodes;
+    Transform*     parent;        /// enclosing transform, or NULL at the top
+
+    mat4           world;         /// parent's model-view times xform
+    ViewFrustum    frustum;       /// view volume in this transform's frame
+    unsigned long  worldVersion;  /// changes each time world is rebuilt
+    const unsigned long  serial;  /// unique to this transform, unlike its
+                                  ///   address, which may be reused
 
-    Transform() : xform(), nodes() {}
+    Transform() : Node( NodeType::Transform ), xform(), nodes(),
+        parent(NULL), world(), frustum(), worldVersion(0),
+        serial( newVersion() ), parentVersion(0), worldDirty(true),
+        subtreeDirty(true), contents(),
+        box(), empty(true), contentsDirty(true), boxDirty(true) {}
     ~Transform()
         { nodes.clear(); }
     
-    void addNode( Node* n )
-        { nodes.push_back( n ); }
+    void addNode( Node* n ) {
+        nodes.push_back( n );
+        ++n->links;
+        ++structureVersion();
+        _adopt( n );
+        contentsChanged();
+    }
+
+    /// Put n in place of the child old, returning false if old isn't one
+    bool replaceNode( Node* old, Node* n ) {
+        auto i = std::find( nodes.begin(), nodes.end(), old );
+        if ( i == nodes.end() ) { return false; }
+
+        *i = n;
+        --old->links;
+        ++n->links;
+        ++structureVersion();
+        _release( old );
+        _adopt( n );
+        contentsChanged();
+        return true;
+    }
+
+    /// Unlink the last occurrence of n from the children, returning false
+    ///   if n isn't one.  The search starts from the end, so removing
+    ///   children newest first is cheap.
+    bool removeNode( Node* n ) {
+        auto i = std::find( nodes.rbegin(), nodes.rend(), n );
+        if ( i == nodes.rend() ) { return false; }
+
+        nodes.erase( std::next( i ).base() );
+        --n->links;
+        ++structureVersion();
+        _release( n );
+        contentsChanged();
+        return true;
+    }
+
+    /// Invalidate cached matrices and bounds after xform (or a child) has
+    ///   changed
+    void changed() {
+        worldDirty = boxDirty = true;
+        for ( Transform* t = parent; t && !t->contentsDirty; t = t->parent ) {
+            t->contentsDirty = t->boxDirty = true;
+        }
+        for ( Transform* t = parent; t && !t->subtreeDirty; t = t->parent ) {
+            t->subtreeDirty = true;
+        }
+    }
+
+    /// Invalidate the children's cached bounds after a child's bounds have
+    ///   changed, or the children themselves
+    void contentsChanged() {
+        contentsDirty = true;
+        changed();
+    }
+
+    /// Union of the children's bounds in this transform's frame
+    bool localBounds( BBox& b ) {
+        if ( contentsDirty ) {
+            empty = true;
+            for ( auto n : nodes ) {
+                BBox nb;
+                if ( n->bounds( nb ) ) {
+                    contents = empty ? nb : contents.merge( nb );
+                    empty = false;
+                }
+            }
+            contentsDirty = false;
+        }
+        b = contents;
+        return !empty;
+    }
+
+    virtual bool bounds( BBox& b ) {
+        if ( boxDirty || contentsDirty ) {
+            BBox local;
+            if ( localBounds( local ) ) { box = local.transform( xform ); }
+            boxDirty = false;
+        }
+        b = box;
+        return !empty;
+    }
+
+    /// Rebuild world and frustum if xform changed or the parent's matrix
+    ///   (with projection P) is not the version they were built from.
+    ///   Returns true if anything was recomputed.
+    bool updateWorld( const mat4& parentWorld, unsigned long version,
+                      const mat4& P ) {
+        if ( !worldDirty && version == parentVersion ) { return false; }
+
+        world = parentWorld * xform;
+        frustum = ViewFrustum( P * world );
+        parentVersion = version;
+        worldVersion = newVersion();
+        worldDirty = false;
+        return true;
+    }
+
+    /// True if neither this transform nor any descendant needs its world
+    ///   rebuilt under a parent matrix of the given version
+    bool subtreeCurrent( unsigned long version ) const
+        { return !worldDirty && !subtreeDirty && version == parentVersion; }
+
+    /// Note that updateWorld() has been called on every descendant since
+    ///   the last changed() below this transform
+    void subtreeUpdated()
+        { subtreeDirty = false; }
+
+    /// Return a version number never handed out before (on any thread)
+    static unsigned long newVersion() {
+        static std::atomic<unsigned long>  version( 0 );
+        return ++version;
+    }
 
     // Function implemented in Traversals.h
     virtual void receive( Traversal* );
+
+  private:
+    unsigned long  parentVersion;  // version of the matrix world came from
+    bool           worldDirty;     // xform changed since world was built
+    bool           subtreeDirty;   // a descendant's xform changed since
+                                   //   subtreeUpdated()
+
+    BBox  contents;       // children's bounds in this frame
+    BBox  box;            // contents transformed by xform
+    bool  empty;          // no child has geometry
+    bool  contentsDirty;  // contents needs rebuilding
+    bool  boxDirty;       // box needs rebuilding
+
+    // Make this the parent of a Transform or LOD child n, or stop being
+    //   it.  Implemented after LOD, below.
+    void _adopt( Node* n );
+    void _release( Node* n );
 };
 
-    
+//----------------------------------------------------------------------------
+//
+// --- LOD ---
+//
+///  @class LOD
+///  @brief Several versions of one object, of which only one is drawn,
+///    chosen by how large the object appears on screen
+///  @details Levels are added finest first, each with the smallest
+///    projected size (in pixels, across the node's bounds) it should be
+///    drawn at; the last level's size should be 0.  RenderTraversal
+///    measures the node each frame and calls select().  To keep an object
+///    whose size hovers near a threshold from flickering between levels, a
+///    level is only left once the size has moved past the threshold by the
+///    hysteresis fraction.
+///
+///    The levels are not owned, and may be shared between LOD nodes, as
+///    the level in use is kept per LOD node.  Adding or removing a level
+///    changes the node's bounds, so the enclosing Transform (parent, set
+///    by Transform::addNode()) is told to rebuild its own.
+
+struct LOD : public Node {
+
+    static const int MaxLevels = 8;
+
+    std::vector<Node*>    levels;      /// versions of the object, finest first
+    std::vector<GLfloat>  minPixels;   /// smallest projected size per level
+    GLfloat               hysteresis;  /// fraction past a threshold before
+                                       ///   changing level
+    int                   current;     /// level drawn last, or -1 before the
+                                       ///   first select()
+    Transform*            parent;      /// enclosing transform, or NULL
+
+    LOD( GLfloat hysteresis = 0.2 ) : Node( NodeType::LOD ), levels(),
+        minPixels(), hysteresis(hysteresis), current(-1), parent(NULL),
+        box(), empty(true) {}
+
+    /// Add the next coarser level, drawn down to a projected size of
+    ///   pixels, returning false (and storing nothing) if the node already
+    ///   has MaxLevels
+    bool addLevel( Node* n, GLfloat pixels ) {
+        if ( levels.size() == MaxLevels ) { return false; }
+        levels.push_back( n );
+        minPixels.push_back( pixels );
+        ++n->links;
+        ++structureVersion();
+
+        BBox b;
+        if ( n->bounds( b ) ) {
+            box = empty ? b : box.merge( b );
+            empty = false;
+        }
+        if ( parent ) { parent->contentsChanged(); }
+        return true;
+    }
+
+    /// Remove every level drawn with n, returning false if there was none
+    bool removeLevel( Node* n ) {
+        bool found = false;
+        for ( size_t i = levels.size(); i-- > 0; ) {
+            if ( levels[i] != n ) { continue; }
+            levels.erase( levels.begin() + i );
+            minPixels.erase( minPixels.begin() + i );
+            --n->links;
+            found = true;
+        }
+        if ( !found ) { return false; }
+
+        ++structureVersion();
+        current = -1;
+        empty = true;
+        for ( auto l : levels ) {
+            BBox b;
+            if ( l->bounds( b ) ) {
+                box = empty ? b : box.merge( b );
+                empty = false;
+            }
+        }
+        if ( parent ) { parent->contentsChanged(); }
+        return true;
+    }
+
+    /// Pick the level to draw at a projected size of pixels
+    int select( GLfloat pixels ) {
+        int last = int( levels.size() ) - 1;
+        if ( last < 0 ) { return -1; }
+
+        if ( current < 0 || current > last ) {
+            current = 0;
+            while ( current < last && pixels < minPixels[current] ) {
+                ++current;
+            }
+            return current;
+        }
+
+        while ( current > 0 &&
+                pixels > minPixels[current - 1] * (1.0 + hysteresis) ) {
+            --current;
+        }
+        while ( current < last &&
+                pixels < minPixels[current] * (1.0 - hysteresis) ) {
+            ++current;
+        }
+        return current;
+    }
+
+    virtual bool bounds( BBox& b )
+        { b = box; return !empty; }
+
+    // Function implemented in Traversals.h
+    virtual void receive( Traversal* );
+
+  private:
+    BBox  box;    // union of the levels' bounds
+    bool  empty;  // no level has geometry
+};
+
+//----------------------------------------------------------------------------
+
+inline void Transform::_adopt( Node* n ) {
+    if ( n->type == NodeType::Transform ) {
+        static_cast<Transform*>( n )->parent = this;
+    }
+    else if ( n->type == NodeType::LOD ) {
+        static_cast<LOD*>( n )->parent = this;
+    }
+}
+
+inline void Transform::_release( Node* n ) {
+    if ( n->type == NodeType::Transform &&
+         static_cast<Transform*>( n )->parent == this ) {
+        static_cast<Transform*>( n )->parent = NULL;
+    }
+    else if ( n->type == NodeType::LOD &&
+              static_cast<LOD*>( n )->parent == this ) {
+        static_cast<LOD*>( n )->parent = NULL;
+    }
+}
+
 //----------------------------------------------------------------------------
 
 };  // namespace Scene
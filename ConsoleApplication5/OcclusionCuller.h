@@ -0,0 +1,268 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- OcclusionCuller.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __OCCLUSIONCULLER_H__
+#define __OCCLUSIONCULLER_H__
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "Angel.h"
+#include "BBox.h"
+#include "Nodes.h"
+#include "RenderQueue.h"
+#include "UniformBlocks.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- OcclusionCuller ---
+//
+/// \class OcclusionCuller
+/// \brief Skips Transform subtrees that hardware occlusion queries found
+///    hidden, using results from earlier frames so it never waits on one
+/// \details RenderTraversal asks visible() about each Transform it
+///    reaches.  The answer is the last query result for the transform's
+///    bounds (its children's box, in its own frame, under its model-view
+///    matrix); a subtree that was hidden is skipped.  Either way the
+///    transform may be queued for a new test.  prepare() adds the tests'
+///    matrices to the frame's Object blocks before the draws are
+///    submitted, so one upload carries both; after the draws have filled
+///    the depth buffer, issue() draws each queued box, with color and
+///    depth writes off, inside a GL_ANY_SAMPLES_PASSED query.
+///    beginFrame() collects the results that have arrived, and leaves the
+///    rest for a later frame.
+///
+///    Hidden subtrees are tested every frame, so they reappear one frame
+///    after they come into view.  Visible ones are assumed to stay
+///    visible for interval frames between tests, staggered so the tests
+///    spread over the frames.  A transform not reached last frame (under
+///    a culled parent, say) is treated as visible until it is tested
+///    again, as is one whose box reaches behind the near plane, since
+///    drawing that box would clip away the part nearest the eye.
+///
+///    Records are keyed by Transform::serial rather than address, so a
+///    transform created where a deleted one was doesn't inherit its
+///    result or query.  The culler must be used and deleted on the GL
+///    thread; visible() only updates existing records, so any number of
+///    gather threads may call it at once.
+
+struct OcclusionCuller {
+
+    typedef Angel::mat4  mat4;
+    typedef Angel::vec3  vec3;
+
+    /// A transform whose bounds are to be tested, and the matrix taking
+    ///   the unit cube to its box in eye space
+    struct Test {
+        Transform*  transform;
+        mat4        MV;
+    };
+
+    unsigned       interval;  /// frames between tests of visible subtrees
+    unsigned long  frame;     /// frames begun
+
+    OcclusionCuller( unsigned interval = 8 ) : interval(interval),
+        frame(0), firstObject(0), records() {
+        program = Angel::AcquireProgram( "default.vert", "default.frag" );
+
+        // the cube from -1 to 1 on each axis
+        GLfloat corners[8][3];
+        for ( int i = 0; i < 8; ++i ) {
+            corners[i][0] = i & 1 ? 1.0f : -1.0f;
+            corners[i][1] = i & 2 ? 1.0f : -1.0f;
+            corners[i][2] = i & 4 ? 1.0f : -1.0f;
+        }
+        const GLubyte faces[36] = {
+            0, 2, 1,  1, 2, 3,   4, 5, 6,  5, 7, 6,   0, 1, 4,  1, 5, 4,
+            2, 6, 3,  3, 6, 7,   0, 4, 2,  2, 4, 6,   1, 3, 5,  3, 7, 5
+        };
+
+        glGenVertexArrays( 1, &vao );
+        glBindVertexArray( vao );
+        glGenBuffers( 2, buffers );
+        glBindBuffer( GL_ARRAY_BUFFER, buffers[0] );
+        glBufferData( GL_ARRAY_BUFFER, sizeof(corners), corners,
+                      GL_STATIC_DRAW );
+        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0) );
+        glEnableVertexAttribArray( 0 );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buffers[1] );
+        glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces,
+                      GL_STATIC_DRAW );
+        glBindVertexArray( 0 );
+    }
+
+    ~OcclusionCuller() {
+        for ( auto& r : records ) { glDeleteQueries( 1, &r.second.query ); }
+        glDeleteBuffers( 2, buffers );
+        glDeleteVertexArrays( 1, &vao );
+        Angel::ReleaseProgram( program );
+    }
+
+    OcclusionCuller( const OcclusionCuller& ) = delete;
+    OcclusionCuller& operator = ( const OcclusionCuller& ) = delete;
+
+    /// Start a frame, collecting every query result that is ready
+    void beginFrame() {
+        ++frame;
+        for ( auto i = records.begin(); i != records.end(); ) {
+            Record& r = i->second;
+            if ( r.pending ) {
+                GLuint ready = 0;
+                glGetQueryObjectuiv( r.query, GL_QUERY_RESULT_AVAILABLE,
+                                     &ready );
+                if ( ready ) {
+                    GLuint samples = 0;
+                    glGetQueryObjectuiv( r.query, GL_QUERY_RESULT, &samples );
+                    r.pending = false;
+                    r.visible = samples != 0;
+                    r.nextTest = r.visible ? frame + interval + r.stagger
+                                           : frame;
+                }
+            }
+
+            // forget transforms long out of reach, which may be deleted
+            if ( !r.pending && r.lastSeen + 4 * interval < frame ) {
+                glDeleteQueries( 1, &r.query );
+                i = records.erase( i );
+            }
+            else { ++i; }
+        }
+    }
+
+    /// Return false if t's subtree was hidden when last tested, queueing
+    ///   t in tests when it is due another test.  Call after t's world
+    ///   matrix and frustum are updated.
+    bool visible( Transform* t, std::vector<Test>& tests ) {
+        BBox b;
+        if ( !t->localBounds( b ) ) { return true; }
+        if ( !_inFront( t->frustum.planes[4], b ) ) { return true; }
+
+        auto i = records.find( t->serial );
+        if ( i == records.end() ) {
+            tests.push_back( _test( t, b ) );
+            return true;
+        }
+
+        Record& r = i->second;
+        if ( r.lastSeen + 1 < frame ) { r.visible = true; }
+        r.lastSeen = frame;
+        if ( !r.pending && frame >= r.nextTest ) {
+            tests.push_back( _test( t, b ) );
+        }
+        return r.visible;
+    }
+
+    /// Append the tests' matrices to the shared Object blocks, to be
+    ///   written by the same uploadObjects() as the frame's draws.  Call
+    ///   before RenderQueue::submit(), then issue() the same tests.
+    void prepare( const std::vector<Test>& tests ) {
+        UniformBlocks& blocks = UniformBlocks::shared();
+        firstObject = blocks.objects.size();
+        for ( auto& test : tests ) { blocks.objects.push_back( test.MV ); }
+    }
+
+    /// Query each test's box against the depth buffer, after the frame's
+    ///   draws, with the projection they left in the Frame block and the
+    ///   matrices prepare() added to their upload
+    void issue( const std::vector<Test>& tests, RenderStats& stats ) {
+        if ( tests.empty() ) { return; }
+
+        UniformBlocks& blocks = UniformBlocks::shared();
+
+        glUseProgram( program );
+        glBindVertexArray( vao );
+        glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+        glDepthMask( GL_FALSE );
+        glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
+
+        for ( size_t t = 0; t < tests.size(); ++t ) {
+            const Test& test = tests[t];
+            auto i = records.find( test.transform->serial );
+            if ( i == records.end() ) {
+                Record r;
+                glGenQueries( 1, &r.query );
+                r.pending = false;
+                r.visible = true;
+                r.lastSeen = frame;
+                r.nextTest = 0;
+
+                // spread the tests of visible boxes over the frames
+                r.stagger = unsigned( test.transform->serial % interval );
+                i = records.insert(
+                    std::make_pair( test.transform->serial, r ) ).first;
+            }
+            Record& r = i->second;
+            if ( r.pending ) { continue; }
+
+            blocks.bindObject( firstObject + t );
+            ++stats.uniforms;
+            glBeginQuery( GL_ANY_SAMPLES_PASSED, r.query );
+            glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_BYTE,
+                            BUFFER_OFFSET(0) );
+            glEndQuery( GL_ANY_SAMPLES_PASSED );
+            r.pending = true;
+            ++stats.occlusionQueries;
+        }
+
+        blocks.fence();
+        glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+        glDepthMask( GL_TRUE );
+        glBindVertexArray( 0 );
+        glUseProgram( 0 );
+    }
+
+    /// Number of transforms with a query
+    size_t size() const
+        { return records.size(); }
+
+  private:
+    struct Record {
+        GLuint         query;
+        bool           pending;   // query issued, result not yet read
+        bool           visible;   // last result
+        unsigned long  lastSeen;  // frame visible() last asked about it
+        unsigned long  nextTest;  // frame from which to test it again
+        unsigned       stagger;   // extra frames between visible tests
+    };
+
+    size_t  firstObject;  // index of the tests' matrices in the upload
+
+    std::unordered_map<unsigned long, Record>  records;  // by serial
+
+    GLuint  program;
+    GLuint  vao;
+    GLuint  buffers[2];  // cube corners and triangle indices
+
+    // True if b is wholly on the inside of plane
+    static bool _inFront( const Angel::vec4& plane, const BBox& b ) {
+        GLfloat x = plane.x > 0.0f ? b.ll.x : b.ur.x;
+        GLfloat y = plane.y > 0.0f ? b.ll.y : b.ur.y;
+        GLfloat z = plane.z > 0.0f ? b.ll.z : b.ur.z;
+        return plane.x*x + plane.y*y + plane.z*z + plane.w > 0.0f;
+    }
+
+    // The test of b in t's frame.  The box is grown slightly, so its faces
+    //   lie in front of the surfaces they bound (which would otherwise hide
+    //   themselves from the depth test) and flat boxes still cover pixels
+    //   when seen edge on.
+    static Test _test( Transform* t, const BBox& b ) {
+        vec3 half = 0.5 * (b.ur - b.ll);
+        GLfloat pad = 1e-2f * b.diameter() + 1e-6f;
+        for ( int i = 0; i < 3; ++i ) { half[i] += pad; }
+
+        Test test = { t, t->world * Angel::Translate( b.center() ) *
+                         Angel::Scale( half ) };
+        return test;
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __OCCLUSIONCULLER_H__
@@ -0,0 +1,202 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- RenderList.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RENDERLIST_H__
+#define __RENDERLIST_H__
+
+#include <vector>
+#include "Angel.h"
+#include "BBox.h"
+#include "Frustum.h"
+#include "Nodes.h"
+#include "RenderQueue.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- RenderList ---
+//
+/// \class RenderList
+/// \brief A flattened copy of a scene graph for rendering
+/// \details RenderTraversal::gatherFlat() compiles the graph into two sets
+///    of parallel arrays: the transforms, each after its parent, with
+///    copies of their cached matrices and frustums, and the extent of each
+///    one's subtree; and one record per
+///    draw holding its state, draw parameters, bounds and the index of its
+///    transform.  Each frame the transforms are refreshed in order and the
+///    draw records are walked linearly into a RenderQueue, with no virtual
+///    dispatch or pointer chasing through the graph.  The list is rebuilt
+///    only when the graph's structure has changed: nodes or LOD levels
+///    added, removed or replaced (see structureVersion()).
+///
+///    Nodes flagged dynamic, which need per-frame work in their visit
+///    method, are kept in a separate list and visited every frame.
+
+struct RenderList {
+
+    typedef Angel::mat4  mat4;
+
+    // --- transforms, each after its parent ---
+    std::vector<Transform*>     transforms;
+    std::vector<int>            parents;    /// parent index, -1 for the scene
+    std::vector<mat4>           worlds;     /// copies of Transform::world
+    std::vector<ViewFrustum>    frustums;   /// copies of Transform::frustum
+    std::vector<unsigned long>  versions;   /// copies of worldVersion
+    std::vector<int>            ends;       /// index after the last
+                                            ///   descendant
+
+    // --- draw records ---
+    std::vector<int>            transform;  /// transform index, -1 for none
+    std::vector<BBox>           bounds;     /// node bounds for culling
+    std::vector<GLuint>         program;
+    std::vector<GLuint>         vao;
+    std::vector<GLuint>         texture;
+    std::vector<GLenum>         polygonMode;
+    std::vector<unsigned char>  blend;
+    std::vector<GLenum>         mode;
+    std::vector<GLint>          first;
+    std::vector<GLsizei>        count;
+    std::vector<GLenum>         indexType;
+    std::vector<size_t>         offset;
+    std::vector<GLsizei>        instances;
+    std::vector<unsigned char>  batched;    /// drawn by StaticBatches instead
+
+    // --- nodes visited every frame ---
+    std::vector<Node*>          dynamicNodes;
+    std::vector<int>            dynamicTransforms;
+
+    unsigned long               structure;  /// structureVersion() compiled
+
+    RenderList() : structure(0) {}
+
+    /// True if nodes have been added since the list was compiled
+    bool stale() const
+        { return structure != structureVersion(); }
+
+    /// Number of draw records
+    size_t size() const
+        { return transform.size(); }
+
+    void clear() {
+        transforms.clear();  parents.clear();  worlds.clear();
+        frustums.clear();  versions.clear();  ends.clear();
+
+        transform.clear();  bounds.clear();  program.clear();  vao.clear();
+        texture.clear();  polygonMode.clear();  blend.clear();
+        mode.clear();  first.clear();  count.clear();  indexType.clear();
+        offset.clear();  instances.clear();  batched.clear();
+
+        dynamicNodes.clear();  dynamicTransforms.clear();
+        structure = 0;
+    }
+
+    /// Append a transform whose cached matrices are current; returns its
+    ///   index
+    int addTransform( Transform* t, int parent ) {
+        transforms.push_back( t );
+        parents.push_back( parent );
+        worlds.push_back( t->world );
+        frustums.push_back( t->frustum );
+        versions.push_back( t->worldVersion );
+        ends.push_back( int( transforms.size() ) );
+        return int( transforms.size() ) - 1;
+    }
+
+    /// Mark the end of transform t's subtree, once its descendants have
+    ///   been added
+    void closeTransform( int t ) {
+        ends[t] = int( transforms.size() );
+    }
+
+    void addDraw( const DrawItem& item, int t, const BBox& b ) {
+        transform.push_back( t );
+        bounds.push_back( b );
+        program.push_back( item.program );
+        vao.push_back( item.vao );
+        texture.push_back( item.texture );
+        polygonMode.push_back( item.polygonMode );
+        blend.push_back( item.blend );
+        mode.push_back( item.mode );
+        first.push_back( item.first );
+        count.push_back( item.count );
+        indexType.push_back( item.indexType );
+        offset.push_back( item.offset );
+        instances.push_back( item.instances );
+        batched.push_back( 0 );
+    }
+
+    void addDynamic( Node* n, int t ) {
+        dynamicNodes.push_back( n );
+        dynamicTransforms.push_back( t );
+    }
+
+    /// Bring the transforms' matrices up to date with the scene's MV
+    ///   (whose version is given) and P, skipping subtrees in which
+    ///   nothing has changed
+    void update( const mat4& MV, unsigned long version, const mat4& P,
+                 RenderStats& stats ) {
+        for ( size_t i = 0; i < transforms.size(); ) {
+            int p = parents[i];
+            const mat4& parentWorld = p < 0 ? MV : worlds[p];
+            unsigned long parentVersion = p < 0 ? version : versions[p];
+
+            Transform* t = transforms[i];
+            if ( t->subtreeCurrent( parentVersion ) ) {
+                i = size_t( ends[i] );
+                continue;
+            }
+            if ( t->updateWorld( parentWorld, parentVersion, P ) ) {
+                worlds[i] = t->world;
+                frustums[i] = t->frustum;
+                versions[i] = t->worldVersion;
+                ++stats.transformsUpdated;
+            }
+            t->subtreeUpdated();
+            ++i;
+        }
+    }
+
+    /// Queue every draw record whose bounds intersect the view volume,
+    ///   apart from those merged into StaticBatches
+    void gather( const mat4& MV, const ViewFrustum& sceneFrustum, bool cull,
+                 RenderQueue& queue ) {
+        DrawItem item;
+        for ( size_t i = 0; i < transform.size(); ++i ) {
+            if ( batched[i] ) { continue; }
+
+            int t = transform[i];
+            if ( cull ) {
+                const ViewFrustum& f = t < 0 ? sceneFrustum : frustums[t];
+                if ( !f.intersects( bounds[i] ) ) {
+                    ++queue.stats.nodesCulled;
+                    continue;
+                }
+            }
+            ++queue.stats.nodesVisible;
+
+            item.program = program[i];
+            item.vao = vao[i];
+            item.texture = texture[i];
+            item.polygonMode = polygonMode[i];
+            item.blend = blend[i] != 0;
+            item.MV = t < 0 ? MV : worlds[t];
+            item.mode = mode[i];
+            item.first = first[i];
+            item.count = count[i];
+            item.indexType = indexType[i];
+            item.offset = offset[i];
+            item.instances = instances[i];
+            queue.add( item );
+        }
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __RENDERLIST_H__
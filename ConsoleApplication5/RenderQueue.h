@@ -0,0 +1,309 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- RenderQueue.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RENDERQUEUE_H__
+#define __RENDERQUEUE_H__
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "Angel.h"
+#include "Nodes.h"
+#include "StreamBuffer.h"
+#include "UniformBlocks.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- DrawItem ---
+//
+/// \class DrawItem
+/// \brief One draw call together with the GL state it needs
+/// \details A zero texture or polygonMode means the draw doesn't care about
+///    that piece of state, and it is left as the previous draw set it.
+
+struct DrawItem {
+
+    typedef Angel::mat4  mat4;
+
+    GLuint         program;      /// shader program
+    GLuint         vao;          /// vertex array object
+    GLuint         texture;      /// 2D texture bound to unit 0, or 0
+    GLenum         polygonMode;  /// GL_FILL or GL_LINE, or 0
+    bool           blend;        /// draw with alpha blending
+    bool           usesMV;       /// the program reads MV from its Object
+                                 ///   block
+    mat4           MV;           /// model-view transformation for the draw
+
+    GLenum         mode;         /// primitive type
+    GLint          first;        /// first vertex (glDrawArrays)
+    GLsizei        count;        /// vertex or index count
+    GLenum         indexType;    /// index type, or 0 for glDrawArrays
+    size_t         offset;       /// byte offset into the element buffer
+    GLsizei        instances;    /// instance count, or 0 if not instanced
+    StreamBuffer*  stream;       /// stream to fence after the draw, or NULL
+
+    GLsizei        drawCount;    /// draws in a multi-draw, or 0 for one
+    GLsizei*       counts;       /// per draw vertex or index count
+    GLint*         firsts;       /// per draw first vertex (arrays)
+    GLvoid**       offsets;      /// per draw element offset (elements)
+    GLint*         baseVertices; /// per draw base vertex (elements)
+
+    unsigned       sequence;     /// queue order, used to keep sorts stable
+
+    DrawItem() :
+        program(0), vao(0), texture(0), polygonMode(0), blend(false),
+        usesMV(true), MV(), mode(GL_TRIANGLES), first(0), count(0),
+        indexType(0), offset(0), instances(0), stream(NULL), drawCount(0),
+        counts(NULL), firsts(NULL), offsets(NULL), baseVertices(NULL),
+        sequence(0) {}
+
+    DrawItem( GeometricObject* node, const mat4& MV, GLenum polygonMode ) :
+        program(node->program), vao(node->vao), texture(node->texture),
+        polygonMode(polygonMode), blend(false), usesMV(true), MV(MV),
+        mode(GL_TRIANGLES), first(0),
+        count(node->numVertices), indexType(0), offset(0), instances(0),
+        stream(NULL), drawCount(0), counts(NULL), firsts(NULL),
+        offsets(NULL), baseVertices(NULL), sequence(0) {}
+
+    /// Set up a glDrawArrays call
+    DrawItem& arrays( GLenum m, GLint f, GLsizei n )
+        { mode = m; first = f; count = n; indexType = 0; return *this; }
+
+    /// Set up a glDrawElements call on indices of type t
+    DrawItem& elements( GLenum m, GLsizei n, size_t byteOffset,
+                        GLenum t = GL_UNSIGNED_INT ) {
+        mode = m; count = n; indexType = t;
+        offset = byteOffset;
+        return *this;
+    }
+
+    /// Make this a glMultiDrawArrays call over n draws (firsts and counts),
+    ///   or with indexType set, a glMultiDrawElementsBaseVertex call (counts,
+    ///   offsets and bases).  The arrays must last until the draw is issued.
+    DrawItem& multi( GLsizei n, GLsizei* c, GLint* f, GLvoid** o,
+                     GLint* bases ) {
+        drawCount = n; counts = c; firsts = f; offsets = o;
+        baseVertices = bases;
+        return *this;
+    }
+
+    /// Order draws so state changes are rare: opaque before blended (so
+    ///   blended draws land on a complete depth buffer), then by program,
+    ///   texture and vertex array, and otherwise in the order queued.
+    bool operator < ( const DrawItem& d ) const {
+        if ( blend != d.blend ) { return d.blend; }
+        if ( program != d.program ) { return program < d.program; }
+        if ( texture != d.texture ) { return texture < d.texture; }
+        if ( vao != d.vao ) { return vao < d.vao; }
+        return sequence < d.sequence;
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+//  --- RenderStats ---
+//
+/// \class RenderStats
+/// \brief Per-frame counts of the GL calls a RenderQueue issued, and of
+///    the work done by the traversal that filled it
+
+struct RenderStats {
+
+    unsigned  drawCalls;     /// glDraw* calls
+    unsigned  stateChanges;  /// program, vao, texture, polygon mode and
+                             ///   blend changes
+    unsigned  uniforms;      /// uniform buffer updates and Object block
+                             ///   rebinds
+    unsigned  nodesVisible;  /// nodes that passed frustum culling
+    unsigned  nodesCulled;   /// nodes (and their subtrees) culled
+    unsigned  transformsUpdated;  /// transforms whose matrices were rebuilt
+    unsigned  nodesOccluded;      /// transforms (and their subtrees) skipped
+                                  ///   as hidden by occlusion culling
+    unsigned  occlusionQueries;   /// occlusion queries issued
+    unsigned  batchedDraws;       /// draws issued within multi-draw calls
+    unsigned  lodDraws[LOD::MaxLevels];  /// LOD nodes drawn at each level
+
+    RenderStats() : drawCalls(0), stateChanges(0), uniforms(0),
+        nodesVisible(0), nodesCulled(0), transformsUpdated(0),
+        nodesOccluded(0), occlusionQueries(0), batchedDraws(0)
+        { std::fill( lodDraws, lodDraws + LOD::MaxLevels, 0u ); }
+
+    RenderStats& operator += ( const RenderStats& s ) {
+        drawCalls += s.drawCalls;  stateChanges += s.stateChanges;
+        uniforms += s.uniforms;  nodesVisible += s.nodesVisible;
+        nodesCulled += s.nodesCulled;
+        transformsUpdated += s.transformsUpdated;
+        nodesOccluded += s.nodesOccluded;
+        occlusionQueries += s.occlusionQueries;
+        batchedDraws += s.batchedDraws;
+        for ( int i = 0; i < LOD::MaxLevels; ++i ) {
+            lodDraws[i] += s.lodDraws[i];
+        }
+        return *this;
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+//  --- RenderQueue ---
+//
+/// \class RenderQueue
+/// \brief Collects the draws of a frame, sorts them by state and issues
+///    only the state changes that differ from the previous draw
+/// \details Matrices reach the shaders through the shared UniformBlocks:
+///    P is written to the Frame block once per submit, and the distinct
+///    MVs of the sorted draws are written to Object blocks with a single
+///    buffer update, so a draw costs at most a rebind of the Object block
+///    (none for draws whose usesMV is false, which take their matrices
+///    elsewhere, or that share the previous draw's MV).  Matrices already
+///    in UniformBlocks::objects when submit() is called (an
+///    OcclusionCuller's, say) are written by the same update, ahead of
+///    the draws'.
+
+struct RenderQueue {
+
+    typedef Angel::mat4  mat4;
+
+    std::vector<DrawItem>  items;
+    RenderStats            stats;
+
+    void clear() {
+        items.clear();
+        stats = RenderStats();
+    }
+
+    void add( const DrawItem& item ) {
+        items.push_back( item );
+        items.back().sequence = unsigned( items.size() );
+    }
+
+    /// Queue another queue's draws after ours, in order, and add its counts
+    ///   to ours
+    void append( const RenderQueue& q ) {
+        items.reserve( items.size() + q.items.size() );
+        for ( auto& item : q.items ) { add( item ); }
+        stats += q.stats;
+    }
+
+    void submit( const mat4& P ) {
+        std::sort( items.begin(), items.end() );
+
+        // one Object block per run of draws sharing a model-view matrix
+        UniformBlocks& blocks = UniformBlocks::shared();
+        std::vector<size_t> slots( items.size() );
+        const DrawItem* last = NULL;
+        for ( size_t i = 0; i < items.size(); ++i ) {
+            const DrawItem& item = items[i];
+            if ( !item.usesMV ) { continue; }
+            if ( !last || memcmp( (const GLfloat*) last->MV,
+                                  (const GLfloat*) item.MV,
+                                  sizeof(mat4) ) != 0 ) {
+                blocks.objects.push_back( item.MV );
+                last = &item;
+            }
+            slots[i] = blocks.objects.size() - 1;
+        }
+
+        blocks.setFrame( P );
+        stats.uniforms += blocks.objects.empty() ? 1 : 2;
+        blocks.uploadObjects();
+
+        GLuint  program = 0, vao = 0, texture = 0;
+        GLenum  polygonMode = 0;
+        bool    blend = false;
+        size_t  slot = size_t(-1);
+
+        for ( size_t i = 0; i < items.size(); ++i ) {
+            const DrawItem& item = items[i];
+            if ( item.program != program ) {
+                glUseProgram( program = item.program );
+                ++stats.stateChanges;
+            }
+
+            if ( item.usesMV && slots[i] != slot ) {
+                blocks.bindObject( slot = slots[i] );
+                ++stats.uniforms;
+            }
+
+            if ( item.vao != vao ) {
+                glBindVertexArray( vao = item.vao );
+                ++stats.stateChanges;
+            }
+
+            if ( item.texture && item.texture != texture ) {
+                glActiveTexture( GL_TEXTURE0 );
+                glBindTexture( GL_TEXTURE_2D, texture = item.texture );
+                ++stats.stateChanges;
+            }
+
+            if ( item.polygonMode && item.polygonMode != polygonMode ) {
+                glPolygonMode( GL_FRONT_AND_BACK,
+                               polygonMode = item.polygonMode );
+                ++stats.stateChanges;
+            }
+
+            if ( item.blend != blend ) {
+                if ( (blend = item.blend) ) { glEnable( GL_BLEND ); }
+                else { glDisable( GL_BLEND ); }
+                ++stats.stateChanges;
+            }
+
+            _draw( item );
+        }
+
+        blocks.fence();
+        if ( blend ) { glDisable( GL_BLEND ); }
+        glUseProgram( 0 );
+        glBindVertexArray( 0 );
+    }
+
+  private:
+    void _draw( const DrawItem& item ) {
+        if ( item.drawCount ) {
+            if ( item.indexType ) {
+                glMultiDrawElementsBaseVertex( item.mode, item.counts,
+                    item.indexType, item.offsets, item.drawCount,
+                    item.baseVertices );
+            }
+            else {
+                glMultiDrawArrays( item.mode, item.firsts, item.counts,
+                                   item.drawCount );
+            }
+            stats.batchedDraws += item.drawCount;
+        }
+        else if ( item.indexType ) {
+            if ( item.instances ) {
+                glDrawElementsInstanced( item.mode, item.count,
+                    item.indexType, BUFFER_OFFSET(item.offset),
+                    item.instances );
+            }
+            else {
+                glDrawElements( item.mode, item.count, item.indexType,
+                                BUFFER_OFFSET(item.offset) );
+            }
+        }
+        else {
+            if ( item.instances ) {
+                glDrawArraysInstanced( item.mode, item.first, item.count,
+                                       item.instances );
+            }
+            else {
+                glDrawArrays( item.mode, item.first, item.count );
+            }
+        }
+        ++stats.drawCalls;
+
+        if ( item.stream ) { item.stream->fence(); }
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __RENDERQUEUE_H__
@@ -7,7 +7,9 @@
 #ifndef __SCENE_H__
 #define __SCENE_H__
 
+#include "BVH.h"
 #include "Nodes.h"
+#include "SceneFile.h"
 #include "SceneGraph.h"
 #include "Traversals.h"
 
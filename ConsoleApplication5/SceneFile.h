@@ -0,0 +1,631 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- SceneFile.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SCENEFILE_H__
+#define __SCENEFILE_H__
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "Angel.h"
+#include "SceneFormat.h"
+#include "SceneGraph.h"
+#include "Shapes.h"
+#include "Traversals.h"
+
+#if defined(_WIN32)
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- SceneFile ---
+//
+/// \class SceneFile
+/// \brief A binary scene file (see SceneFormat.h) mapped into memory
+/// \details open() maps the file read-only and checks its header; the
+///    records are then read in place.  load() builds the nodes, uploading
+///    each mesh's blobs directly from the mapping.  Mesh records are
+///    stored once however many nodes use them, and each is uploaded once
+///    too: its nodes share the GL objects through MeshCache, keyed by the
+///    file's path and size and the record's index.
+
+struct SceneFile {
+
+    SceneFile() : base(NULL), size(0)
+#if defined(_WIN32)
+        , file(INVALID_HANDLE_VALUE), mapping(NULL)
+#endif
+        {}
+
+    ~SceneFile()
+        { close(); }
+
+    /// Map the file at path, returning false if it can't be read or isn't
+    ///   a scene file this version understands
+    bool open( const char* path ) {
+        close();
+        this->path = path;
+
+#if defined(_WIN32)
+        file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+        if ( file == INVALID_HANDLE_VALUE ) { return false; }
+
+        LARGE_INTEGER length;
+        if ( !GetFileSizeEx( file, &length ) || length.QuadPart == 0 ) {
+            close();
+            return false;
+        }
+        size = size_t( length.QuadPart );
+
+        mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if ( mapping ) {
+            base = (const unsigned char*)
+                MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+        }
+#else
+        int fd = ::open( path, O_RDONLY );
+        if ( fd < 0 ) { return false; }
+
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+            size = size_t( st.st_size );
+            void* p = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+            base = p == MAP_FAILED ? NULL : (const unsigned char*) p;
+        }
+        ::close( fd );
+#endif
+
+        if ( !base || !_valid() ) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#if defined(_WIN32)
+        if ( base ) { UnmapViewOfFile( base ); }
+        if ( mapping ) { CloseHandle( mapping ); }
+        if ( file != INVALID_HANDLE_VALUE ) { CloseHandle( file ); }
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if ( base ) { munmap( (void*) base, size ); }
+#endif
+        base = NULL;
+        size = 0;
+    }
+
+    const SceneHeader& header() const
+        { return *(const SceneHeader*) base; }
+
+    const SceneNodeRecord* nodes() const
+        { return (const SceneNodeRecord*) (base + header().nodeOffset); }
+
+    const SceneMeshRecord* meshes() const
+        { return (const SceneMeshRecord*) (base + header().meshOffset); }
+
+    /// Create the file's nodes in s.  Its top-level nodes are added to
+    ///   parent, or to s itself if parent is NULL.
+    void load( SceneGraph* s, Transform* parent = NULL ) const {
+        const SceneNodeRecord* records = nodes();
+        std::vector<Transform*> transforms( header().nodeCount, NULL );
+
+        for ( uint32_t i = 0; i < header().nodeCount; ++i ) {
+            const SceneNodeRecord& r = records[i];
+
+            Node* node;
+            if ( r.kind == SceneTransformNode ) {
+                Transform* t = s->create<Transform>();
+                memcpy( (GLfloat*) t->xform, r.xform, sizeof(r.xform) );
+                node = transforms[i] = t;
+            }
+            else {
+                node = s->create<Mesh>( meshes()[r.mesh], base,
+                                        _meshKey( r.mesh ) );
+            }
+
+            if ( r.parent >= 0 ) { transforms[r.parent]->addNode( node ); }
+            else if ( parent ) { parent->addNode( node ); }
+            else { s->addNode( node ); }
+        }
+    }
+
+  private:
+    const unsigned char*  base;  // start of the mapping, or NULL
+    size_t                size;  // bytes mapped
+    std::string           path;  // as given to open()
+#if defined(_WIN32)
+    HANDLE                file;
+    HANDLE                mapping;
+#endif
+
+    // MeshCache key for mesh record i
+    std::string _meshKey( uint32_t i ) const {
+        return "scene file " + path + " " + std::to_string( size ) +
+               " mesh " + std::to_string( i );
+    }
+
+    bool _inside( uint64_t offset, uint64_t bytes ) const
+        { return offset <= size && bytes <= size - offset; }
+
+    bool _inside( const SceneBlob& b ) const
+        { return _inside( b.offset, b.size ); }
+
+    // Bytes in one element of a vertex attribute or index, or 0 for a type
+    //   the loader doesn't accept
+    static uint64_t _typeSize( uint32_t type ) {
+        switch ( type ) {
+            case GL_BYTE: case GL_UNSIGNED_BYTE:             return 1;
+            case GL_SHORT: case GL_UNSIGNED_SHORT:
+            case GL_HALF_FLOAT:                              return 2;
+            case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+            default:                                         return 0;
+        }
+    }
+
+    // True if every vertex (or, with a divisor, every instance) the
+    //   attribute can be asked for lies inside its stream
+    bool _validAttribute( const SceneMeshRecord& m, const SceneAttribute& a,
+                          uint64_t instances ) const {
+        uint64_t element = _typeSize( a.type );
+        if ( a.stream >= m.streamCount || a.size < 1 || a.size > 4 ||
+             !element ) {
+            return false;
+        }
+
+        uint64_t bytes = element * a.size;
+        uint64_t stride = a.stride ? a.stride : bytes;
+        uint64_t count = a.divisor ? (instances + a.divisor - 1) / a.divisor
+                                   : m.numVertices;
+        return count == 0 ||
+               uint64_t( a.offset ) + (count - 1) * stride + bytes <=
+                   m.streams[a.stream].size;
+    }
+
+    // True if the draw reads only vertices below numVertices and, when
+    //   indexed, only indices inside the element blob
+    bool _validDraw( const SceneMeshRecord& m, const SceneDraw& d ) const {
+        if ( !d.indexType ) {
+            return uint64_t( d.first ) + d.count <= m.numVertices;
+        }
+
+        uint64_t element = _typeSize( d.indexType );
+        if ( d.indexType != GL_UNSIGNED_BYTE &&
+             d.indexType != GL_UNSIGNED_SHORT &&
+             d.indexType != GL_UNSIGNED_INT ) {
+            return false;
+        }
+        if ( d.offset % element ||
+             uint64_t( d.offset ) + d.count * element > m.indices.size ) {
+            return false;
+        }
+
+        const unsigned char* p = base + m.indices.offset + d.offset;
+        for ( uint32_t i = 0; i < d.count; ++i, p += element ) {
+            uint32_t index = element == 1 ? *p :
+                element == 2 ? uint32_t( *(const uint16_t*) p ) :
+                               *(const uint32_t*) p;
+            if ( index >= m.numVertices ) { return false; }
+        }
+        return true;
+    }
+
+    // Check everything load() relies on, so a damaged file can't make it
+    //   read outside the mapping, or the GL outside the buffers load()
+    //   gives it
+    bool _valid() const {
+        if ( size < sizeof(SceneHeader) ) { return false; }
+
+        const SceneHeader& h = header();
+        if ( memcmp( h.magic, SceneMagic, sizeof(SceneMagic) ) != 0 ||
+             h.version != SceneVersion || h.fileSize != size ||
+             !_inside( h.nodeOffset,
+                       uint64_t( h.nodeCount ) * sizeof(SceneNodeRecord) ) ||
+             !_inside( h.meshOffset,
+                       uint64_t( h.meshCount ) * sizeof(SceneMeshRecord) ) ) {
+            return false;
+        }
+
+        for ( uint32_t i = 0; i < h.meshCount; ++i ) {
+            const SceneMeshRecord& m = meshes()[i];
+            if ( m.streamCount > SceneMeshRecord::MaxStreams ||
+                 m.attributeCount > SceneMeshRecord::MaxAttributes ||
+                 m.drawCount > SceneMeshRecord::MaxDraws ||
+                 !memchr( m.vertexShader, 0, SceneMeshRecord::MaxPath ) ||
+                 !memchr( m.fragmentShader, 0, SceneMeshRecord::MaxPath ) ||
+                 !_inside( m.indices ) || !_inside( m.texels ) ||
+                 m.texels.size < uint64_t( m.textureWidth ) *
+                     m.textureHeight * 3 ) {
+                return false;
+            }
+            for ( uint32_t j = 0; j < m.streamCount; ++j ) {
+                if ( !_inside( m.streams[j] ) ) { return false; }
+            }
+
+            uint64_t instances = 1;
+            for ( uint32_t j = 0; j < m.drawCount; ++j ) {
+                if ( !_validDraw( m, m.draws[j] ) ) { return false; }
+                instances = std::max<uint64_t>( instances,
+                                                m.draws[j].instances );
+            }
+            for ( uint32_t j = 0; j < m.attributeCount; ++j ) {
+                if ( !_validAttribute( m, m.attributes[j], instances ) ) {
+                    return false;
+                }
+            }
+        }
+
+        for ( uint32_t i = 0; i < h.nodeCount; ++i ) {
+            const SceneNodeRecord& n = nodes()[i];
+            if ( n.parent >= int32_t( i ) ||
+                 ( n.parent >= 0 &&
+                   nodes()[n.parent].kind != SceneTransformNode ) ||
+                 ( n.kind == SceneMeshNode && n.mesh >= h.meshCount ) ||
+                 ( n.kind != SceneMeshNode && n.kind != SceneTransformNode ) ) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+//  --- SceneWriter ---
+//
+/// \class SceneWriter
+/// \brief A traversal that records a scene graph for writing to a file
+/// \details Each geometric object's vertex layout, buffers and texture are
+///    read back from the GL through its vertex array object, and its draws
+///    are captured by visiting it with a RenderTraversal, so any shape can
+///    be saved without knowing how it was built.  Dynamic nodes are saved
+///    as they are at the time of the traversal and load as static meshes.
+///    Objects whose program didn't come from Angel::AcquireProgram(), or
+///    that exceed the record limits, are counted in skipped and left out.
+///    The format has no LOD records, so an LOD node is saved as its finest
+///    level.
+
+struct SceneWriter : public StaticTraversal<SceneWriter> {
+
+    typedef Angel::mat4  mat4;
+
+    using StaticTraversal<SceneWriter>::visit;
+
+    std::vector<SceneNodeRecord>  nodes;
+    std::vector<SceneMeshRecord>  meshes;
+    std::vector<unsigned char>    blobs;    /// blob data; offsets in meshes
+                                            ///   are relative to its start
+    unsigned                      skipped;  /// objects that couldn't be saved
+
+    SceneWriter() : nodes(), meshes(), blobs(), skipped(0), parent(-1),
+        identity() {}
+
+    void traverse( SceneGraph* s ) {
+        scene = s;
+        nodes.clear();
+        meshes.clear();
+        blobs.clear();
+        blobIndex.clear();
+        meshIndex.clear();
+        skipped = 0;
+        parent = -1;
+
+        capture.scene = s;
+        capture.modelView = &identity;
+
+        for ( auto n : s->nodes ) {
+            visitNode( n );
+        }
+    }
+
+    /// Write the traversed scene to path, returning false on any I/O error
+    bool write( const char* path ) const {
+        SceneHeader h;
+        memcpy( h.magic, SceneMagic, sizeof(SceneMagic) );
+        h.version = SceneVersion;
+        h.nodeCount = uint32_t( nodes.size() );
+        h.meshCount = uint32_t( meshes.size() );
+        h.nodeOffset = sizeof(SceneHeader);
+        h.meshOffset = h.nodeOffset + nodes.size() * sizeof(SceneNodeRecord);
+
+        uint64_t blobBase = _align( h.meshOffset +
+                                    meshes.size() * sizeof(SceneMeshRecord) );
+        h.fileSize = blobBase + blobs.size();
+
+        std::vector<SceneMeshRecord> records( meshes );
+        for ( auto& m : records ) {
+            for ( uint32_t i = 0; i < m.streamCount; ++i ) {
+                m.streams[i].offset += blobBase;
+            }
+            if ( m.indices.size ) { m.indices.offset += blobBase; }
+            if ( m.texels.size ) { m.texels.offset += blobBase; }
+        }
+
+        FILE* f = fopen( path, "wb" );
+        if ( !f ) { return false; }
+
+        std::vector<unsigned char> padding(
+            size_t( blobBase - h.meshOffset -
+                    records.size() * sizeof(SceneMeshRecord) ), 0 );
+
+        bool ok = fwrite( &h, sizeof(h), 1, f ) == 1;
+        if ( ok && !nodes.empty() ) {
+            ok = fwrite( &nodes[0], sizeof(SceneNodeRecord), nodes.size(), f )
+                == nodes.size();
+        }
+        if ( ok && !records.empty() ) {
+            ok = fwrite( &records[0], sizeof(SceneMeshRecord),
+                         records.size(), f ) == records.size();
+        }
+        if ( ok && !padding.empty() ) {
+            ok = fwrite( &padding[0], 1, padding.size(), f ) == padding.size();
+        }
+        if ( ok && !blobs.empty() ) {
+            ok = fwrite( &blobs[0], 1, blobs.size(), f ) == blobs.size();
+        }
+        return fclose( f ) == 0 && ok;
+    }
+
+    void visit( GeometricObject* node ) { _mesh( node ); }
+
+    void visit( LOD* node ) {
+        if ( !node->levels.empty() ) { visitNode( node->levels[0] ); }
+    }
+
+    void visit( Transform* node ) {
+        SceneNodeRecord r = _node( node, SceneTransformNode );
+        memcpy( r.xform, (const GLfloat*) node->xform, sizeof(r.xform) );
+        nodes.push_back( r );
+
+        int saved = parent;
+        parent = int( nodes.size() ) - 1;
+        for ( auto n : node->nodes ) {
+            visitNode( n );
+        }
+        parent = saved;
+    }
+
+  private:
+    typedef std::map< uint64_t, std::vector<uint64_t> >  Index;
+
+    int              parent;     // record index of the enclosing transform
+    mat4             identity;
+    RenderTraversal  capture;    // collects the draws of each object
+    Index            blobIndex;  // content hash to blob offsets
+    Index            meshIndex;  // content hash to mesh indices
+
+    static uint64_t _align( uint64_t offset ) {
+        return (offset + SceneAlignment - 1) / SceneAlignment *
+            SceneAlignment;
+    }
+
+    // 64-bit FNV-1a
+    static uint64_t _hash( const void* data, size_t size ) {
+        const unsigned char* p = (const unsigned char*) data;
+        uint64_t h = 14695981039346656037ULL;
+        for ( size_t i = 0; i < size; ++i ) {
+            h = (h ^ p[i]) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+    SceneNodeRecord _node( Node* n, SceneNodeKind kind ) const {
+        SceneNodeRecord r;
+        memset( &r, 0, sizeof(r) );
+        r.kind = kind;
+        r.parent = parent;
+        memcpy( r.xform, (const GLfloat*) identity, sizeof(r.xform) );
+
+        BBox b;
+        if ( n->bounds( b ) ) {
+            r.hasBounds = 1;
+            memcpy( r.ll, &b.ll.x, sizeof(r.ll) );
+            memcpy( r.ur, &b.ur.x, sizeof(r.ur) );
+        }
+        return r;
+    }
+
+    // Store data as a blob, or find an identical one already stored
+    SceneBlob _blob( const void* data, size_t size ) {
+        SceneBlob b = { 0, size };
+        if ( !size ) { return b; }
+
+        std::vector<uint64_t>& matches = blobIndex[_hash( data, size )];
+        for ( auto offset : matches ) {
+            if ( offset + size <= blobs.size() &&
+                 memcmp( &blobs[size_t( offset )], data, size ) == 0 ) {
+                b.offset = offset;
+                return b;
+            }
+        }
+
+        b.offset = _align( blobs.size() );
+        blobs.resize( size_t( b.offset ) + size, 0 );
+        memcpy( &blobs[size_t( b.offset )], data, size );
+        matches.push_back( b.offset );
+        return b;
+    }
+
+    // Read a buffer object back from the GL into a blob
+    SceneBlob _buffer( GLuint buffer ) {
+        GLint size = 0;
+        glBindBuffer( GL_COPY_READ_BUFFER, buffer );
+        glGetBufferParameteriv( GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size );
+
+        std::vector<unsigned char> data( size );
+        if ( size ) {
+            glGetBufferSubData( GL_COPY_READ_BUFFER, 0, size, &data[0] );
+        }
+        glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+        return _blob( data.empty() ? NULL : &data[0], data.size() );
+    }
+
+    void _mesh( GeometricObject* node ) {
+        SceneMeshRecord m;
+        memset( &m, 0, sizeof(m) );
+
+        const char* vs;
+        const char* fs;
+        if ( !Angel::ProgramShaderFiles( node->program, vs, fs ) ||
+             strlen( vs ) >= SceneMeshRecord::MaxPath ||
+             strlen( fs ) >= SceneMeshRecord::MaxPath ) {
+            ++skipped;
+            return;
+        }
+        strcpy( m.vertexShader, vs );
+        strcpy( m.fragmentShader, fs );
+
+        memcpy( m.ll, &node->bbox.ll.x, sizeof(m.ll) );
+        memcpy( m.ur, &node->bbox.ur.x, sizeof(m.ur) );
+        m.numVertices = node->numVertices;
+
+        // the draws first, since visiting may update the vertex state
+        capture.queue.clear();
+        capture.visitNode( node );
+        if ( capture.queue.items.size() > SceneMeshRecord::MaxDraws ) {
+            ++skipped;
+            return;
+        }
+        for ( auto& item : capture.queue.items ) {
+            SceneDraw& d = m.draws[m.drawCount++];
+            d.mode = item.mode;
+            d.first = item.first;
+            d.count = item.count;
+            d.indexType = item.indexType;
+            d.offset = uint32_t( item.offset );
+            d.instances = item.instances;
+            d.polygonMode = item.polygonMode;
+            d.blend = item.blend;
+        }
+
+        glBindVertexArray( node->vao );
+
+        GLint maxAttributes = 0;
+        glGetIntegerv( GL_MAX_VERTEX_ATTRIBS, &maxAttributes );
+
+        std::vector<GLint> streamBuffers;
+        for ( GLint loc = 0; loc < maxAttributes; ++loc ) {
+            GLint enabled = 0;
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_ENABLED,
+                                 &enabled );
+            if ( !enabled ) { continue; }
+
+            if ( m.attributeCount == SceneMeshRecord::MaxAttributes ) {
+                glBindVertexArray( 0 );
+                ++skipped;
+                return;
+            }
+
+            GLint buffer, size, type, normalized, stride, divisor;
+            GLvoid* pointer;
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING,
+                                 &buffer );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_SIZE, &size );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_TYPE, &type );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED,
+                                 &normalized );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &stride );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_DIVISOR,
+                                 &divisor );
+            glGetVertexAttribPointerv( loc, GL_VERTEX_ATTRIB_ARRAY_POINTER,
+                                       &pointer );
+
+            uint32_t stream = 0;
+            while ( stream < streamBuffers.size() &&
+                    streamBuffers[stream] != buffer ) {
+                ++stream;
+            }
+            if ( stream == streamBuffers.size() ) {
+                if ( stream == SceneMeshRecord::MaxStreams ) {
+                    glBindVertexArray( 0 );
+                    ++skipped;
+                    return;
+                }
+                streamBuffers.push_back( buffer );
+            }
+
+            SceneAttribute& a = m.attributes[m.attributeCount++];
+            a.location = loc;
+            a.size = size;
+            a.type = type;
+            a.normalized = normalized;
+            a.stride = stride;
+            a.offset = uint32_t( (size_t) pointer );
+            a.divisor = divisor;
+            a.stream = stream;
+        }
+
+        GLint ebo = 0;
+        glGetIntegerv( GL_ELEMENT_ARRAY_BUFFER_BINDING, &ebo );
+        glBindVertexArray( 0 );
+
+        m.streamCount = uint32_t( streamBuffers.size() );
+        for ( uint32_t i = 0; i < m.streamCount; ++i ) {
+            m.streams[i] = _buffer( streamBuffers[i] );
+        }
+        if ( ebo ) { m.indices = _buffer( ebo ); }
+
+        if ( node->texture ) {
+            GLint width = 0, height = 0;
+            glBindTexture( GL_TEXTURE_2D, node->texture );
+            glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,
+                                      &width );
+            glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT,
+                                      &height );
+
+            std::vector<unsigned char> texels( size_t( width ) * height * 3 );
+            if ( !texels.empty() ) {
+                glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+                glGetTexImage( GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                               &texels[0] );
+                glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+
+                m.textureWidth = width;
+                m.textureHeight = height;
+                m.texels = _blob( &texels[0], texels.size() );
+            }
+        }
+
+        SceneNodeRecord r = _node( node, SceneMeshNode );
+        r.mesh = _addMesh( m );
+        nodes.push_back( r );
+    }
+
+    // Store m, or find an identical mesh already stored
+    uint32_t _addMesh( const SceneMeshRecord& m ) {
+        std::vector<uint64_t>& matches = meshIndex[_hash( &m, sizeof(m) )];
+        for ( auto i : matches ) {
+            if ( memcmp( &meshes[size_t( i )], &m, sizeof(m) ) == 0 ) {
+                return uint32_t( i );
+            }
+        }
+        matches.push_back( meshes.size() );
+        meshes.push_back( m );
+        return uint32_t( meshes.size() - 1 );
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __SCENEFILE_H__
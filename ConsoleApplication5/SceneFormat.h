@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- SceneFormat.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SCENEFORMAT_H__
+#define __SCENEFORMAT_H__
+
+#include <cstdint>
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- Binary scene file layout ---
+//
+//  A scene file is, in order:
+//
+//    SceneHeader
+//    SceneNodeRecord[nodeCount]   the hierarchy in depth-first order
+//    SceneMeshRecord[meshCount]   geometry, shaders and draws per mesh
+//    blobs                        vertex, index and texel data
+//
+//  Every record has a fixed size and only fixed-width fields, and every
+//    blob starts on a SceneAlignment boundary, so a memory-mapped file can
+//    be used in place: records are read through pointers into the mapping
+//    and blobs are handed straight to glBufferData() and glTexImage2D().
+//    Offsets are in bytes from the start of the file.  Identical blobs and
+//    identical mesh records are stored once.
+//
+
+const char      SceneMagic[4] = { 'S', 'C', 'N', 'B' };
+const uint32_t  SceneVersion = 1;
+const uint32_t  SceneAlignment = 16;
+
+struct SceneHeader {
+    char      magic[4];     /// SceneMagic
+    uint32_t  version;      /// SceneVersion
+    uint32_t  nodeCount;
+    uint32_t  meshCount;
+    uint64_t  nodeOffset;   /// first SceneNodeRecord
+    uint64_t  meshOffset;   /// first SceneMeshRecord
+    uint64_t  fileSize;     /// total bytes, to detect truncation
+};
+
+/// A run of bytes elsewhere in the file; size 0 means absent
+struct SceneBlob {
+    uint64_t  offset;
+    uint64_t  size;
+};
+
+/// One glVertexAttribPointer() call
+struct SceneAttribute {
+    uint32_t  location;
+    uint32_t  size;        /// components
+    uint32_t  type;        /// GL_FLOAT, GL_UNSIGNED_BYTE, ...
+    uint32_t  normalized;
+    uint32_t  stride;
+    uint32_t  offset;      /// byte offset into the stream
+    uint32_t  divisor;     /// instancing divisor
+    uint32_t  stream;      /// index into SceneMeshRecord::streams
+};
+
+/// One draw call, as a RenderTraversal queues it
+struct SceneDraw {
+    uint32_t  mode;
+    uint32_t  first;
+    uint32_t  count;
+    uint32_t  indexType;    /// 0 for glDrawArrays
+    uint32_t  offset;       /// byte offset into the index blob
+    uint32_t  instances;    /// 0 if not instanced
+    uint32_t  polygonMode;  /// 0 to leave as is
+    uint32_t  blend;
+};
+
+struct SceneMeshRecord {
+
+    static const int MaxStreams = 4;
+    static const int MaxAttributes = 8;
+    static const int MaxDraws = 4;
+    static const int MaxPath = 128;
+
+    char            vertexShader[MaxPath];    /// NUL-terminated file names
+    char            fragmentShader[MaxPath];
+    float           ll[3];                    /// bounding box
+    float           ur[3];
+    uint32_t        numVertices;
+    uint32_t        streamCount;
+    uint32_t        attributeCount;
+    uint32_t        drawCount;
+    SceneBlob       streams[MaxStreams];      /// vertex buffers
+    SceneAttribute  attributes[MaxAttributes];
+    SceneDraw       draws[MaxDraws];
+    SceneBlob       indices;                  /// element buffer
+    SceneBlob       texels;                   /// RGB8 texture, rows unpadded
+    uint32_t        textureWidth;
+    uint32_t        textureHeight;
+};
+
+enum SceneNodeKind {
+    SceneTransformNode = 0,
+    SceneMeshNode = 1
+};
+
+struct SceneNodeRecord {
+    uint32_t  kind;       /// SceneNodeKind
+    int32_t   parent;     /// index of the parent transform, or -1 for a
+                          ///   top-level node of the scene graph
+    uint32_t  mesh;       /// SceneMeshRecord index, for mesh nodes
+    uint32_t  hasBounds;
+    float     xform[16];  /// row-major, for transform nodes
+    float     ll[3];      /// bounds in the parent's frame, if hasBounds
+    float     ur[3];
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __SCENEFORMAT_H__
@@ -7,7 +7,10 @@
 #ifndef __SCENEGRAPH_H__
 #define __SCENEGRAPH_H__
 
+#include <algorithm>
+#include <cstring>
 #include "Angel.h"
+#include "NodePool.h"
 #include "Nodes.h"
 
 namespace Scene {
@@ -19,6 +22,16 @@ namespace Scene {
 /// \class SceneGraph
 /// \brief Container class that is the root of the scene graph for the
 ///    application, and holds  all of the nodes in a scene
+/// \details Nodes made with create() live in a NodePool per node type
+///    owned by the scene graph, and are destroyed (releasing their GL
+///    objects) with it, so it must be deleted while the GL context is
+///    current.  nodes only lists the top of the hierarchy and owns nothing.
+///
+///    A node can be destroyed on its own with destroy(), which first
+///    unlinks it from wherever it is still held (see removeNode()) and
+///    unlinks its own children and levels, so nothing in the graph is left
+///    pointing at it.  Each of these bumps structureVersion(), so the
+///    RenderList, BVH and StaticBatches built from the graph rebuild.
 
 struct SceneGraph {
 
@@ -30,13 +43,119 @@ struct SceneGraph {
     mat4  P;  /// Projection transformation for the scene
     mat4  MV; /// Current model-view transformation for the scene
 
-    SceneGraph() : nodes(), P(), MV() {}
+    SceneGraph() : nodes(), P(), MV(), lastP(), lastMV(), _version(0),
+        pools() {}
 
-    ~SceneGraph()
-        { nodes.clear(); }
+    ~SceneGraph() {
+        nodes.clear();
+        for ( size_t i = pools.size(); i-- > 0; ) { delete pools[i]; }
+    }
 
-    void addNode( Node* n )
-        { nodes.push_back( n ); }
+    SceneGraph( const SceneGraph& ) = delete;
+    SceneGraph& operator = ( const SceneGraph& ) = delete;
+
+    /// Construct a node of type T from args in the scene's storage
+    template <typename T, typename... Args>
+    NodeHandle<T> create( Args&&... args )
+        { return pool<T>().create( std::forward<Args>( args )... ); }
+
+    /// Destroy a node made by create(), first removing it from the graph
+    ///   and detaching its children.  Removing it from its parent first
+    ///   (Transform::removeNode()) spares the search of every Transform.
+    template <typename T>
+    void destroy( const NodeHandle<T>& h ) {
+        T* n = h.get();
+        if ( !n ) { return; }
+
+        if ( n->links ) { removeNode( n ); }
+        if ( n->type == NodeType::Transform ) {
+            Transform* t = static_cast<Transform*>( static_cast<Node*>( n ) );
+            while ( !t->nodes.empty() ) { t->removeNode( t->nodes.back() ); }
+        }
+        else if ( n->type == NodeType::LOD ) {
+            LOD* lod = static_cast<LOD*>( static_cast<Node*>( n ) );
+            while ( !lod->levels.empty() ) {
+                lod->removeLevel( lod->levels.back() );
+            }
+        }
+        pool<T>().destroy( h );
+    }
+
+    /// The pool holding nodes of type T
+    template <typename T>
+    NodePool<T>& pool() {
+        size_t id = _poolId<T>();
+        if ( id >= pools.size() ) { pools.resize( id + 1, NULL ); }
+        if ( !pools[id] ) { pools[id] = new NodePool<T>(); }
+        return *static_cast<NodePool<T>*>( pools[id] );
+    }
+
+    /// Number of live nodes made by create()
+    size_t nodeCount() const {
+        size_t n = 0;
+        for ( auto p : pools ) { n += p ? p->size() : 0; }
+        return n;
+    }
+
+    void addNode( Node* n ) {
+        nodes.push_back( n );
+        ++n->links;
+        ++structureVersion();
+    }
+
+    /// Unlink n everywhere it is held: the top of the hierarchy, every
+    ///   Transform made by create() and every LOD's levels.  Visits each
+    ///   Transform and LOD unless n is only held at the top.
+    void removeNode( Node* n ) {
+        for ( auto i = nodes.begin(); i != nodes.end(); ) {
+            if ( *i == n ) {
+                i = nodes.erase( i );
+                --n->links;
+                ++structureVersion();
+            }
+            else { ++i; }
+        }
+        if ( !n->links ) { return; }
+
+        pool<Transform>().forEach( [n]( Transform* t ) {
+            while ( n->links && t->removeNode( n ) ) {}
+        } );
+        pool<LOD>().forEach( [n]( LOD* lod ) {
+            if ( n->links ) { lod->removeLevel( n ); }
+        } );
+    }
+
+    /// Return the version of P and MV, which changes whenever either has
+    ///   been modified since the previous call.  Transforms compare it to
+    ///   decide whether their cached matrices are stale.
+    unsigned long version() {
+        if ( !_version || memcmp( (GLfloat*) P, (GLfloat*) lastP, sizeof(mat4) ) ||
+             memcmp( (GLfloat*) MV, (GLfloat*) lastMV, sizeof(mat4) ) ) {
+            lastP = P;
+            lastMV = MV;
+            _version = Transform::newVersion();
+        }
+        return _version;
+    }
+
+  private:
+    mat4           lastP;     // P and MV as of the last version() call
+    mat4           lastMV;
+    unsigned long  _version;
+
+    std::vector<PoolBase*>  pools;  // indexed by _poolId<T>()
+
+    static size_t _nextPoolId() {
+        static size_t  id = 0;
+        return id++;
+    }
+
+    // A small index unique to each node type
+    template <typename T>
+    static size_t _poolId() {
+        static const size_t  id = _nextPoolId();
+        return id;
+    }
 };
 
 //----------------------------------------------------------------------------
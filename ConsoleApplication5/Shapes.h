@@ -7,11 +7,17 @@
 #ifndef __SHAPES_H__
 #define __SHAPES_H__
 
+#include <algorithm>
+#include <cstddef>
 #include <iostream>
 #include <string>
 #include <vector>
 #include "Angel.h"
+#include "MeshOptimizer.h"
 #include "Nodes.h"
+#include "SceneFormat.h"
+#include "StreamBuffer.h"
+#include "VertexFormat.h"
 #include <cmath>
 #include <SOIL.h>
 #include <time.h>
@@ -36,11 +42,13 @@ struct GroundPlane : public GeometricObject {
     GroundPlane( const std::string& vs = "default.vert",
                  const std::string& fs = "default.frag" ) :
         GeometricObject( vs, fs ) {
-        
+        type = NodeType::GroundPlane;
         glBindVertexArray( vao );
 
         struct Vertex {
             vec2  pos;
+
+            operator HalfVec2() const { return HalfVec2( pos ); }
         };
         
         std::vector<Vertex> vertices = {
@@ -60,12 +68,20 @@ struct GroundPlane : public GeometricObject {
             numVertices++;
         }
 
-        glBufferData( GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
-                      &vertices[0], GL_STATIC_DRAW );
-
         GLint vPosition = glGetAttribLocation( program, "vPosition" );
-        glVertexAttribPointer( vPosition, 2, GL_FLOAT, GL_FALSE,
-                               sizeof(Vertex), BUFFER_OFFSET(0) );
+        if ( VertexFormat::compact() ) {
+            std::vector<HalfVec2> halves( vertices.begin(), vertices.end() );
+            glBufferData( GL_ARRAY_BUFFER, numVertices * sizeof(HalfVec2),
+                          &halves[0], GL_STATIC_DRAW );
+            glVertexAttribPointer( vPosition, 2, GL_HALF_FLOAT, GL_FALSE,
+                                   sizeof(HalfVec2), BUFFER_OFFSET(0) );
+        }
+        else {
+            glBufferData( GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
+                          &vertices[0], GL_STATIC_DRAW );
+            glVertexAttribPointer( vPosition, 2, GL_FLOAT, GL_FALSE,
+                                   sizeof(Vertex), BUFFER_OFFSET(0) );
+        }
         glEnableVertexAttribArray( vPosition );
     }
 
@@ -92,9 +108,40 @@ struct Cone : public GeometricObject {
           const std::string& vs = "default.vert",
           const std::string& fs = "default.frag" ) :
         GeometricObject( vs, fs ) {
-
+        type = NodeType::Cone;
         glBindVertexArray( vao );
 
+        const bool compact = VertexFormat::compact();
+        std::string key = "Cone " + std::to_string( numSides ) +
+            (compact ? " compact" : "");
+        if ( acquireMesh( key ) ) {
+            ebo = shared->ebo;
+            numConeVerties = shared->counts[0];
+            numBaseVertices = shared->counts[1];
+        }
+        else {
+            _build( numSides, compact );
+            shareMesh( key, ebo, { numConeVerties, numBaseVertices } );
+        }
+
+        GLint vPosition = glGetAttribLocation( program, "vPosition" );
+        if ( compact ) {
+            glVertexAttribPointer( vPosition, 3, GL_HALF_FLOAT, GL_FALSE,
+                                   sizeof(HalfPosition), BUFFER_OFFSET(0) );
+        }
+        else {
+            glVertexAttribPointer( vPosition, 3, GL_FLOAT, GL_FALSE,
+                                   sizeof(vec3), BUFFER_OFFSET(0) );
+        }
+        glEnableVertexAttribArray( vPosition );
+    }
+
+    // Function implemented in Traversals.h
+    virtual void receive( Traversal* );
+
+  private:
+    // Generate the mesh into vbo and a new ebo, leaving both bound
+    void _build( const GLsizei numSides, bool compact ) {
         typedef std::vector<vec3>  Vertices;
         typedef std::vector<GLuint>   Indices;
         
@@ -135,113 +182,220 @@ struct Cone : public GeometricObject {
         bbox.ll = vec3( -1.0, -1.0, 0.0 );
         bbox.ur = vec3(  1.0,  1.0, 1.0 );
 
-        glBufferData( GL_ARRAY_BUFFER,
-                      vertices.size() * sizeof(Vertices::value_type),
-                      &vertices[0], GL_STATIC_DRAW );
+        if ( compact ) {
+            std::vector<HalfPosition> halves( vertices.begin(),
+                                              vertices.end() );
+            glBufferData( GL_ARRAY_BUFFER,
+                          halves.size() * sizeof(HalfPosition),
+                          &halves[0], GL_STATIC_DRAW );
+        }
+        else {
+            glBufferData( GL_ARRAY_BUFFER,
+                          vertices.size() * sizeof(Vertices::value_type),
+                          &vertices[0], GL_STATIC_DRAW );
+        }
 
         glGenBuffers( 1, &ebo );
         glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebo );
         glBufferData( GL_ELEMENT_ARRAY_BUFFER,
                       indices.size() * sizeof(Indices::value_type),
                       &indices[0], GL_STATIC_DRAW );
-        
-        GLint vPosition = glGetAttribLocation( program, "vPosition" );
-        glVertexAttribPointer( vPosition, 3, GL_FLOAT, GL_FALSE,
-                               sizeof(Vertices::value_type),
-                               BUFFER_OFFSET(0) );
-        glEnableVertexAttribArray( vPosition );
     }
-
-    // Function implemented in Traversals.h
-    virtual void receive( Traversal* );
 };
 
 struct Sphere : public GeometricObject
 {
 	typedef Angel::vec2  vec2;
 	typedef Angel::vec3  vec3;
-	int width, height, channels;
-	
-	GLubyte* pixels = SOIL_load_image("silver_texture.jpg", &width, &height,
-		&channels, SOIL_LOAD_RGB);
+	struct Vertex {
+		vec3 coordinates;
+		vec2 texcoordinates;
+	};
+	struct CompactVertex {
+		HalfPosition coordinates;
+		HalfVec2 texcoordinates;
+	};
+
+	GLuint   ebo;         /// vertex index buffer
+	GLsizei  numIndices;  /// indices drawn as GL_TRIANGLES
+	GLenum   indexType;   /// GL_UNSIGNED_SHORT when the vertices allow
 	
+	// space is the step in degrees between rings and between segments,
+	//   and must divide 180
 	Sphere(const GLsizei Radius = 3, const std::string& vs = "default.vert",
-		const std::string& fs = "default.frag") :
+		const std::string& fs = "default.frag", const int space = 6) :
 		GeometricObject(vs, fs) {
-		struct Vertex {
-			vec3 coordinates;
-			vec2 texcoordinates;
-		};
-		
+		type = NodeType::Sphere;
+		const bool compact = VertexFormat::compact();
+		std::string key = "Sphere " + std::to_string(Radius) + " " +
+			std::to_string(space) + (compact ? " compact" : "");
+		if (acquireMesh(key))
+		{
+			ebo = shared->ebo;
+			numIndices = shared->counts[0];
+			indexType = shared->counts[1];
+		}
+		else
+		{
+			_build(Radius, space, compact);
+			shareMesh(key, ebo, { numIndices, GLsizei(indexType) });
+		}
+
+		GLint vPosition = 0;
+		GLint vTexCoord = 2;
+		if (compact)
+		{
+			glVertexAttribPointer(vPosition, 3, GL_HALF_FLOAT, GL_FALSE,
+				sizeof(CompactVertex), BUFFER_OFFSET(0));
+			glVertexAttribPointer(vTexCoord, 2, GL_HALF_FLOAT, GL_FALSE,
+				sizeof(CompactVertex),
+				BUFFER_OFFSET(offsetof(CompactVertex, texcoordinates)));
+		}
+		else
+		{
+			glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), BUFFER_OFFSET(0));
+			glVertexAttribPointer(vTexCoord, 2, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), BUFFER_OFFSET(sizeof(vec3)));
+		}
+		glEnableVertexAttribArray(vPosition);
+		glEnableVertexAttribArray(vTexCoord);
+	}
+	virtual void receive(Traversal*);
+
+	// Generate the sphere as an indexed triangle list.  Each point of the
+	//   grid of rings and segments is pushed in or out from Radius by a
+	//   random amount, the same for every point of a pole and for both ends
+	//   of a ring, so the surface is rough but closed.  Two triangles are
+	//   made per grid cell (one next to a pole), the duplicated vertices are
+	//   welded, and unless optimize is false the triangles are reordered for
+	//   the vertex cache and the vertices for fetching.
+	static void tessellate(const GLsizei Radius, const int space,
+		std::vector<Vertex>& verts, std::vector<GLuint>& indices,
+		bool optimize = true)
+	{
 		double pi = M_PI;
-		const int space = 6; // this can be constructor based
-		const int VertexCount = (180 / space) * (360 / space) * 2;
-		double h, k, z;
-		h = 0;
-		k = h;
-		z = h;
-		std::vector<Vertex> verts;
-		double a, b;
-		for (b = 0; b <= 180 - space; b += space)
+		const int rings = 180 / space, segments = 360 / space;
+
+		srand(time(NULL));
+		std::vector<float> offsets((rings + 1) * (segments + 1));
+		for (int i = 0; i <= rings; ++i)
 		{
-			srand(time(NULL));
-			for (a = 0; a <= 360 - space; a += space)
+			for (int j = 0; j <= segments; ++j)
 			{
-				
-				float offset =  (rand() % 4) * 0.05;
+				float offset = (rand() % 4) * 0.05;
 				if (offset == 0)
 					offset += 0.25;
-				int choice = rand() % 2;
-				if (choice == 0)
-				{
+				if (rand() % 2 == 0)
 					offset *= -1;
+
+				if ((i == 0 || i == rings) && j > 0)
+					offset = offsets[i * (segments + 1)];
+				if (j == segments)
+					offset = offsets[i * (segments + 1)];
+				offsets[i * (segments + 1) + j] = offset;
+			}
+		}
+
+		auto point = [&](int i, int j) {
+			double a = j * space, b = i * space;
+			float r = Radius - offsets[i * (segments + 1) + j];
+			Vertex v = { vec3(r * std::sin(a / 180 * pi) * std::sin(b / 180 * pi),
+				r * std::cos(a / 180 * pi) * std::sin(b / 180 * pi),
+				r * std::cos(b / 180 * pi)),
+				vec2(a / 360, (2 * b) / 360) };
+			return v;
+		};
+
+		verts.clear();
+		for (int i = 0; i < rings; ++i)
+		{
+			for (int j = 0; j < segments; ++j)
+			{
+				if (i > 0)
+				{
+					verts.push_back(point(i, j));
+					verts.push_back(point(i + 1, j));
+					verts.push_back(point(i, j + 1));
+				}
+				if (i < rings - 1)
+				{
+					verts.push_back(point(i, j + 1));
+					verts.push_back(point(i + 1, j));
+					verts.push_back(point(i + 1, j + 1));
 				}
-				verts.push_back({ vec3((Radius-offset) * std::sin((a) / 180 * pi) * std::sin((b) / 180 * pi) - h,
-					(Radius - offset) * std::cos((a) / 180 * pi) * std::sin((b) / 180 * pi) + k,
-					(Radius - offset) * std::cos((b) / 180 * pi) - z),
-					vec2(((a) / 360), ((2 * b) / 360) ) });
-				
-				verts.push_back({ vec3((Radius - offset) * std::sin((a) / 180 * pi) * std::sin((b + space) / 180 * pi) - h,
-					(Radius - offset) * std::cos((a) / 180 * pi) * std::sin((b + space) / 180 * pi) + k,
-					(Radius - offset) * std::cos((b + space) / 180 * pi) - z),
-					vec2((a / 360), ((2 * (b + space)) / 360)) });
-
-				/*verts.push_back({ vec3((Radius - offset) * std::sin((a + space) / 180 * pi) * std::sin((b) / 180 * pi) - h,
-					(Radius - offset) * std::cos((a + space) / 180 * pi) * std::sin((b) / 180 * pi) + k,
-					(Radius - offset) * std::cos((b) / 180 * pi) - z),
-					vec2(((a + space) / 360), ((2 * b) / 360)) });
-
-				verts.push_back({ vec3((Radius - offset) * std::sin((a + space) / 180 * pi) * std::sin((b + space) / 180 * pi) - h,
-					(Radius - offset) * std::cos((a + space) / 180 * pi) * sin((b + space) / 180 * pi) + k,
-					(Radius - offset) * std::cos((b + space) / 180 * pi) - z),
-					vec2(((a + space) / 360), ((2 * (b + space)) / 360) ) });*/
 			}
 		}
+
+		weldVertices(verts, indices);
+		if (optimize)
+		{
+			optimizeVertexCache(indices, verts.size());
+			optimizeVertexFetch(verts, indices);
+		}
+	}
+
+  private:
+	// Generate the mesh into vbo and a new ebo, and load its texture
+	void _build(const GLsizei Radius, const int space, bool compact)
+	{
+		std::vector<Vertex> verts;
+		std::vector<GLuint> indices;
+		tessellate(Radius, space, verts, indices);
+
+		bbox.ll = bbox.ur = verts[0].coordinates;
+		for (auto& v : verts)
+		{
+			bbox.ll = Angel::min(bbox.ll, v.coordinates);
+			bbox.ur = Angel::max(bbox.ur, v.coordinates);
+		}
+		numVertices = verts.size();
+		numIndices = indices.size();
 		
-		
-	
-		bbox.ll = vec3(-0.0, -0.0, -2.0);
-		bbox.ur = vec3(0.0, 0.0, 20.0);
-		numVertices = VertexCount;
-		
-		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
-			&verts[0], GL_STATIC_DRAW);
-		
-		
-		GLint vPosition = 0;
-		glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), BUFFER_OFFSET(0));
-		glEnableVertexAttribArray(vPosition);
-		
-		GLint vTexCoord = 2;
-		glVertexAttribPointer(vTexCoord, 2, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), BUFFER_OFFSET(sizeof(vec3)));
-		glEnableVertexAttribArray(vTexCoord);
+		if (compact)
+		{
+			std::vector<CompactVertex> halves(numVertices);
+			for (GLsizei i = 0; i < numVertices; ++i)
+			{
+				halves[i].coordinates = verts[i].coordinates;
+				halves[i].texcoordinates = verts[i].texcoordinates;
+			}
+			glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(CompactVertex),
+				&halves[0], GL_STATIC_DRAW);
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
+				&verts[0], GL_STATIC_DRAW);
+		}
+
+		// 16-bit indices halve the element buffer of any sphere up to a
+		//   step of 2 degrees
+		glGenBuffers(1, &ebo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		if (numVertices <= 65536)
+		{
+			std::vector<GLushort> shorts(indices.begin(), indices.end());
+			indexType = GL_UNSIGNED_SHORT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLushort),
+				&shorts[0], GL_STATIC_DRAW);
+		}
+		else
+		{
+			indexType = GL_UNSIGNED_INT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLuint),
+				&indices[0], GL_STATIC_DRAW);
+		}
+
+		int width, height, channels;
+		GLubyte* pixels = SOIL_load_image("silver_texture.jpg", &width,
+			&height, &channels, SOIL_LOAD_RGB);
 
 		glActiveTexture(GL_TEXTURE0);
 		GLuint tex;
 		glGenTextures(1, &tex);
 		glBindTexture(GL_TEXTURE_2D, tex);
+		texture = tex;
 
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0,
 			GL_RGB, GL_UNSIGNED_BYTE, pixels);
@@ -250,9 +404,9 @@ struct Sphere : public GeometricObject
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		
+
+		SOIL_free_image_data(pixels);
 	}
-	virtual void receive(Traversal*);
 };
 //uses line quads, looks pretty neat
 struct SphereLines : public GeometricObject
@@ -260,9 +414,6 @@ struct SphereLines : public GeometricObject
 	typedef Angel::vec2  vec2;
 	typedef Angel::vec3  vec3;
 	typedef Angel::vec4  vec4;
-	int width, height, channels;
-
-	GLubyte* pixels = SOIL_load_image("Smoke.jpg", &width, &height, &channels, SOIL_LOAD_RGB);
 	struct Vertex {
 		vec3 coordinates;
 		vec4 color;
@@ -276,12 +427,202 @@ struct SphereLines : public GeometricObject
 		}
 
 	};
+	struct CompactVertex {
+		HalfPosition coordinates;
+		Color8 color;
+		HalfVec2 texture;
+	};
 	const int space = 6;
 	const int VertexCount = (180 / space) * (360 / space) * 16;
-	std::vector<Vertex> vectors;
+
+	// Particle simulation state.  When gpuParticles is set the colors live
+	//   in two buffers that LineDecay.vert ping-pongs between with transform
+	//   feedback each frame, so only the spawn list is sent from the CPU.
+	static const int SpawnsPerFrame = 5;  /// quads re-ignited per frame
+	static const int MaxSpawn = 8;        /// must match LineDecay.vert
+
+	bool    gpuParticles;     /// simulate on the GPU rather than in update()
+	GLuint  colorBuffers[2];  /// ping-pong particle color buffers
+	GLuint  feedbackVaos[2];  /// vaos reading colorBuffers[i] for feedback
+	GLuint  feedbackProgram;  /// LineDecay.vert transform feedback program
+	int     current;          /// index of the buffer holding live colors
+	GLint   uNumSpawn;
+	GLint   uSpawn;
+	GLint   uDecay;
+
+	// CPU simulation state: update() ages colors, which stream() then pushes
+	//   through colorStream rather than re-specifying the vbo.  A compact
+	//   node streams them as packed RGBA8, a quarter of the bytes.
+	std::vector<vec4>    colors;
+	std::vector<Color8>  packedColors;
+	StreamBuffer*        colorStream;
+	bool                 compact;  /// built with the compact vertex layout
+
 	SphereLines(const GLsizei Radius = 5, const std::string& vs = "Line.vert",
-		const std::string& fs = "Line.frag") :
-		GeometricObject(vs, fs) {
+		const std::string& fs = "Line.frag", bool gpuParticles = true) :
+		GeometricObject(vs, fs), gpuParticles(gpuParticles), current(0),
+		colorStream(NULL), compact(VertexFormat::compact()) {
+		type = NodeType::SphereLines;
+		dynamic = true;  // simulated every frame in RenderTraversal
+		std::string key = "SphereLines " + std::to_string(Radius) +
+			(compact ? " compact" : "");
+		if (!acquireMesh(key))
+		{
+			_build(Radius);
+			shareMesh(key);
+		}
+
+		GLint vPosition = 4;
+		GLint vColor = 1;
+		GLint vTexCoord = 3;
+		if (compact)
+		{
+			glVertexAttribPointer(vPosition, 3, GL_HALF_FLOAT, GL_FALSE,
+				sizeof(CompactVertex), BUFFER_OFFSET(0));
+			glVertexAttribPointer(vColor, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+				sizeof(CompactVertex),
+				BUFFER_OFFSET(offsetof(CompactVertex, color)));
+			glVertexAttribPointer(vTexCoord, 2, GL_HALF_FLOAT, GL_FALSE,
+				sizeof(CompactVertex),
+				BUFFER_OFFSET(offsetof(CompactVertex, texture)));
+		}
+		else
+		{
+			glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), BUFFER_OFFSET(0));
+			glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), BUFFER_OFFSET(sizeof(vec3)));
+			glVertexAttribPointer(vTexCoord, 2, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), BUFFER_OFFSET(sizeof(vec3) + sizeof(vec4)));
+		}
+		glEnableVertexAttribArray(vPosition);
+		glEnableVertexAttribArray(vColor);
+		glEnableVertexAttribArray(vTexCoord);
+
+		_initFeedback();
+	}
+
+	virtual ~SphereLines() {
+		delete colorStream;
+		glDeleteVertexArrays(2, feedbackVaos);
+		glDeleteBuffers(2, colorBuffers);
+		glDeleteProgram(feedbackProgram);
+	}
+
+	virtual void receive(Traversal*);
+
+	// Advance the simulation one frame on the GPU: re-ignite up to
+	//   SpawnsPerFrame random quads and decay every other vertex's alpha
+	//   by the same amount SpawnsPerFrame calls to update() would.
+	void simulate()
+	{
+		GLint spawn[MaxSpawn];
+		for (int i = 0; i < SpawnsPerFrame; ++i)
+		{
+			spawn[i] = rand() % (numVertices / 4);
+		}
+
+		glUseProgram(feedbackProgram);
+		glUniform1i(uNumSpawn, SpawnsPerFrame);
+		glUniform1iv(uSpawn, SpawnsPerFrame, spawn);
+		glUniform1f(uDecay, 0.01f * SpawnsPerFrame);
+
+		glEnable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(feedbackVaos[current]);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0,
+			colorBuffers[1 - current]);
+
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, numVertices);
+		glEndTransformFeedback();
+
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		glDisable(GL_RASTERIZER_DISCARD);
+		current = 1 - current;
+
+		// point the render vao's color attribute at the new colors
+		GLint vColor = 1;
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, colorBuffers[current]);
+		glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE,
+			sizeof(vec4), BUFFER_OFFSET(0));
+	}
+
+	int update(int* oldStart)
+	{
+
+		
+
+		int choice = rand() % colors.size();
+		if ((choice % 4) == 1)
+		{
+			choice -= 1;
+		}
+		if ((choice % 4) == 2)
+		{
+			choice -= 2;
+		}
+		if ((choice % 4) == 3)
+		{
+			choice -= 3;
+		}
+		colors[choice].w = 1;
+		colors[choice + 1].w = 1;
+		colors[choice + 2].w = 1;
+		colors[choice + 3].w = 1;
+
+
+		int timestart = glutGet(GLUT_ELAPSED_TIME);
+		int deltaTime = (timestart - *oldStart)*0.001;
+		
+		oldStart = &timestart;
+
+
+
+		for (int i = 0; i < colors.size(); ++i)
+		{
+			colors[i].w -= 0.01;
+		}
+		return deltaTime;
+
+	}
+
+	// Upload the colors aged by update() into the next region of the color
+	//   stream and point the render vao at them.  Call colorStream->fence()
+	//   once the draw has been issued.
+	void stream()
+	{
+		GLsizeiptr size = colors.size() *
+			(compact ? sizeof(Color8) : sizeof(vec4));
+		if (!colorStream || colorStream->regionSize < size)
+		{
+			delete colorStream;
+			colorStream = new StreamBuffer(GL_ARRAY_BUFFER, size);
+		}
+
+		GLint vColor = 1;
+		if (compact)
+		{
+			packedColors.assign(colors.begin(), colors.end());
+			GLintptr offset = colorStream->write(&packedColors[0], size);
+			glBindVertexArray(vao);
+			glVertexAttribPointer(vColor, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+				sizeof(Color8), BUFFER_OFFSET(offset));
+		}
+		else
+		{
+			GLintptr offset = colorStream->write(&colors[0], size);
+			glBindVertexArray(vao);
+			glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE,
+				sizeof(vec4), BUFFER_OFFSET(offset));
+		}
+	}
+
+  private:
+	// Generate the mesh into vbo and load its texture
+	void _build(const GLsizei Radius)
+	{
+		std::vector<Vertex> vectors;
 		double h, k, z;
 		h = 0;
 		k = h;
@@ -351,36 +692,42 @@ struct SphereLines : public GeometricObject
 			}
 		}
 		
-		bbox.ll = vec3(-0.0, -0.0, -0.0);
-		bbox.ur = vec3(0.0, 0.0, 20.0);
+		// Line.vert offsets each vertex's x and y from the origin in eye
+		//   space, so the lines can point any direction once transformed;
+		//   bound them by the sphere their longest offset sweeps out
+		GLfloat reach = Radius + yoffset;
+		bbox.ll = vec3(-reach, -reach, -reach);
+		bbox.ur = vec3(reach, reach, reach);
 		numVertices = VertexCount;
 
-
-
-		GLint vPosition = 4;
-		glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), BUFFER_OFFSET(0));
-		glEnableVertexAttribArray(vPosition);
-
-		GLint vColor = 1;
-		glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), BUFFER_OFFSET(sizeof(vec3)));
-		glEnableVertexAttribArray(vColor);
-
-
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
-			&vectors[0], GL_STATIC_DRAW);
+		if (compact)
+		{
+			std::vector<CompactVertex> packed(numVertices);
+			for (GLsizei i = 0; i < numVertices; ++i)
+			{
+				packed[i].coordinates = vectors[i].coordinates;
+				packed[i].color = vectors[i].color;
+				packed[i].texture = vectors[i].texture;
+			}
+			glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(CompactVertex),
+				&packed[0], GL_STATIC_DRAW);
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
+				&vectors[0], GL_STATIC_DRAW);
+		}
 
-		GLint vTexCoord = 3;
-		glVertexAttribPointer(vTexCoord, 2, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), BUFFER_OFFSET(sizeof(vec3)*sizeof(vec4)));
-		glEnableVertexAttribArray(vTexCoord);
+		int width, height, channels;
+		GLubyte* pixels = SOIL_load_image("Smoke.jpg", &width, &height,
+			&channels, SOIL_LOAD_RGB);
 
 		glActiveTexture(GL_TEXTURE1);
 		GLuint tex;
 		glGenTextures(1, &tex);
 		glBindTexture(GL_TEXTURE_2D, tex);
+		texture = tex;
 
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0,
 			GL_RGB, GL_UNSIGNED_BYTE, pixels);
@@ -390,176 +737,214 @@ struct SphereLines : public GeometricObject
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
-
-
+		SOIL_free_image_data(pixels);
 	}
-	virtual void receive(Traversal*);
 
-	int update(int* oldStart)
+	void _initFeedback()
 	{
-
-		
-
-		int choice = rand() % vectors.size();
-		if ((choice % 4) == 1)
+		const GLchar* varyings[] = { "tfColor" };
+		feedbackProgram = Angel::InitTransformFeedbackShader("LineDecay.vert",
+			varyings, 1);
+		uNumSpawn = glGetUniformLocation(feedbackProgram, "numSpawn");
+		uSpawn = glGetUniformLocation(feedbackProgram, "spawn");
+		uDecay = glGetUniformLocation(feedbackProgram, "decay");
+
+		// every vertex starts out transparent black, as _build() made it
+		colors.assign(numVertices, vec4(0.0));
+
+		glGenBuffers(2, colorBuffers);
+		glGenVertexArrays(2, feedbackVaos);
+		for (int i = 0; i < 2; ++i)
 		{
-			choice -= 1;
+			glBindBuffer(GL_ARRAY_BUFFER, colorBuffers[i]);
+			glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(vec4),
+				&colors[0], GL_DYNAMIC_COPY);
+
+			GLint vColor = 0;
+			glBindVertexArray(feedbackVaos[i]);
+			glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE,
+				sizeof(vec4), BUFFER_OFFSET(0));
+			glEnableVertexAttribArray(vColor);
 		}
-		if ((choice % 4) == 2)
-		{
-			choice -= 2;
-		}
-		if ((choice % 4) == 3)
-		{
-			choice -= 3;
-		}
-		vectors[choice].color.w = 1;
-		vectors[choice + 1].color.w = 1;
-		vectors[choice + 2].color.w = 1;
-		vectors[choice + 3].color.w = 1;
-
-
-		int timestart = glutGet(GLUT_ELAPSED_TIME);
-		int deltaTime = (timestart - *oldStart)*0.001;
-		
-		oldStart = &timestart;
-
-
-
+		glBindVertexArray(0);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
-			&vectors[0], GL_STATIC_DRAW);
+	}
+};
 
-		for (int i = 0; i < vectors.size(); ++i)
-		{
-			vectors[i].color.w -= 0.01;
-		}
-		return deltaTime;
+//----------------------------------------------------------------------------
+//
+//  --- InstancedGeometry ---
+//
+///  @class InstancedGeometry
+///  @brief Many copies of one mesh, each with its own transformation and
+///    color, drawn with a single instanced call per draw of the mesh
+///  @details The mesh's buffers are shared rather than copied: the node's
+///    vertex array object points at the mesh's vertex and element buffers,
+///    and adds the per-instance attributes from FirstInstanceAttribute on.
+///    An instance is the top three rows of its model matrix and an RGBA8
+///    color, 52 bytes.  The mesh should be a static shape using attribute
+///    locations below FirstInstanceAttribute; it is not owned, and needn't
+///    be in the scene graph itself.
+///
+///    Call upload() on the GL thread after changing instances.  A dynamic
+///    node is uploaded every frame as it is drawn instead, through a
+///    StreamBuffer so the copy never waits on the GL.  upload() recomputes
+///    bbox; the enclosing Transform's changed() must still be called if
+///    the instances moved.
+
+struct InstancedGeometry : public GeometricObject {
+
+    typedef Angel::mat4  mat4;
+    typedef Angel::vec4  vec4;
+
+    static const GLuint FirstInstanceAttribute = 8;
+
+    struct Instance {
+        vec4     rows[3];   /// top three rows of the model matrix
+        GLubyte  color[4];  /// RGBA
+
+        Instance() {}
+        Instance( const mat4& m, const vec4& c = vec4( 1.0 ) ) {
+            for ( int i = 0; i < 3; ++i ) { rows[i] = m[i]; }
+            for ( int i = 0; i < 4; ++i ) {
+                GLfloat v = std::min( std::max( c[i], 0.0f ), 1.0f );
+                color[i] = GLubyte( v * 255.0 + 0.5 );
+            }
+        }
 
-	}
+        mat4 matrix() const
+            { return mat4( rows[0], rows[1], rows[2], vec4( 0, 0, 0, 1 ) ); }
+    };
+
+    GeometricObject*       mesh;            /// shape drawn for each instance
+    std::vector<Instance>  instances;
+    StreamBuffer*          instanceStream;  /// instance data of a dynamic
+                                            ///   node, or NULL
+
+    InstancedGeometry( GeometricObject* mesh,
+                       const std::vector<Instance>& instances =
+                           std::vector<Instance>(),
+                       bool dynamic = false,
+                       const std::string& vs = "Instanced.vert",
+                       const std::string& fs = "Instanced.frag" ) :
+        GeometricObject( vs, fs ), mesh(mesh), instances(instances),
+        instanceStream(NULL) {
+        type = NodeType::InstancedGeometry;
+        this->dynamic = dynamic;
+        numVertices = mesh->numVertices;
+        texture = mesh->texture;
+
+        _shareAttributes();
+        upload();
+    }
 
-};
+    virtual ~InstancedGeometry()
+        { delete instanceStream; }
 
-//used to attempted instancing, failed horribly
-struct LineQuad : public GeometricObject
-{
-	int width, height, channels;
-
-	GLubyte* pixels = SOIL_load_image("Smoke.jpg", &width, &height,
-		&channels, SOIL_LOAD_RGB);
-	typedef Angel::vec4 vec4;
-	typedef Angel::vec3 vec3;
-	typedef Angel::vec2 vec2;
-	LineQuad(const std::string& vs = "Line.vert",
-	const std::string& fs = "Line.frag") :
-	
-	GeometricObject(vs, fs)
-	{
-		struct Vertex {
-			vec3 coordinates;
-			
-			vec2 texcoordinates;
-		};
-		std::vector<Vertex> my_verts;
-		std::vector<vec3> coordinates;
-		std::vector<vec2> texcoord;
-		my_verts.push_back({vec3(1, 0.2, 0.0), vec2(1, 0)});
-		my_verts.push_back({ vec3(7, 0.2, 0.1),  vec2(1, 1) });
-		my_verts.push_back({ vec3(1, -0.2, 0.0),  vec2(0, 0) });
-		my_verts.push_back({ vec3(7, -0.2, 0.1),  vec2(0, 1) });
-		bbox.ll = vec3(-0.0, -0.0, -2.0);
-		bbox.ur = vec3(0.0, 0.0, 15.0);
-		numVertices = my_verts.size();
-		//here is some experimental instancing code
-
-		GLuint billboard_vertex_buffer;
-		glGenBuffers(1, &billboard_vertex_buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, billboard_vertex_buffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(my_verts), &my_verts[0], GL_STATIC_DRAW);
-
-		// The VBO containing the positions and sizes of the particles
-		GLuint particles_position_buffer;
-		glGenBuffers(1, &particles_position_buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, particles_position_buffer);
-		// Initialize with empty (NULL) buffer : it will be updated later, each frame.
-		glBufferData(GL_ARRAY_BUFFER, 10000 * 4 * sizeof(vec3), NULL, GL_STREAM_DRAW);
-
-		// The VBO containing the colors of the particles
-		GLuint particles_color_buffer;
-		glGenBuffers(1, &particles_color_buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, particles_color_buffer);
-		// Initialize with empty (NULL) buffer : it will be updated later, each frame.
-		glBufferData(GL_ARRAY_BUFFER, 10000 * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW);
-		
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, billboard_vertex_buffer);
-		glVertexAttribPointer(
-			0, // attribute. No particular reason for 0, but must match the layout in the shader.
-			3, // size
-			GL_FLOAT, // type
-			GL_FALSE, // normalized?
-			0, // stride
-			(void*)0 // array buffer offset
-			);
-
-		// 2nd attribute buffer : positions of particles' centers
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, particles_position_buffer);
-		glVertexAttribPointer(
-			1, // attribute. No particular reason for 1, but must match the layout in the shader.
-			4, // size : x + y + z + size => 4
-			GL_FLOAT, // type
-			GL_FALSE, // normalized?
-			0, // stride
-			(void*)0 // array buffer offset
-			);
-
-		// 3rd attribute buffer : particles' colors
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, particles_color_buffer);
-		glVertexAttribPointer(
-			2, // attribute. No particular reason for 1, but must match the layout in the shader.
-			4, // size : r + g + b + a => 4
-			GL_UNSIGNED_BYTE, // type
-			GL_TRUE, // normalized? *** YES, this means that the unsigned char[4] will be accessible with a vec4 (floats) in the shader ***
-			0, // stride
-			(void*)0 // array buffer offset
-			);
-
-		//some seperation to seperate working code from experimental instancing code
-		GLint vPosition = 4;
-		glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), BUFFER_OFFSET(0));
-		glEnableVertexAttribArray(vPosition);
+    /// Send instances to the GL and recompute bbox
+    void upload() {
+        bbox = BBox();
+        for ( size_t i = 0; i < instances.size(); ++i ) {
+            BBox b = mesh->bbox.transform( instances[i].matrix() );
+            bbox = i ? bbox.merge( b ) : b;
+        }
 
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
-			&my_verts[0], GL_STATIC_DRAW);
+        GLsizeiptr size = instances.size() * sizeof(Instance);
+        if ( dynamic ) {
+            if ( !instanceStream || instanceStream->regionSize < size ) {
+                delete instanceStream;
+                instanceStream = new StreamBuffer( GL_ARRAY_BUFFER,
+                    std::max<GLsizeiptr>( size + size / 2, sizeof(Instance) ) );
+            }
+            if ( size ) {
+                GLintptr offset = instanceStream->write( &instances[0], size );
+                _pointInstances( instanceStream->buffer, offset );
+            }
+        }
+        else {
+            glBindBuffer( GL_ARRAY_BUFFER, vbo );
+            glBufferData( GL_ARRAY_BUFFER, size,
+                          size ? &instances[0] : NULL, GL_STATIC_DRAW );
+            _pointInstances( vbo, 0 );
+        }
+    }
 
-		GLint vTexCoord = 3;
-		glVertexAttribPointer(vTexCoord, 2, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), BUFFER_OFFSET(sizeof(vec3)));
-		glEnableVertexAttribArray(vTexCoord);
+    // Function implemented in Traversals.h
+    virtual void receive( Traversal* );
 
-		glActiveTexture(GL_TEXTURE0);
-		GLuint tex;
-		glGenTextures(1, &tex);
-		glBindTexture(GL_TEXTURE_2D, tex);
+  private:
+    // Point vao at the same vertex attributes and element buffer as the
+    //   mesh's, and enable the instance attributes
+    void _shareAttributes() {
+        struct Attribute {
+            GLint    location, buffer, size, type, normalized, stride;
+            GLvoid*  pointer;
+        };
+        std::vector<Attribute> attributes;
+
+        glBindVertexArray( mesh->vao );
+        for ( GLuint loc = 0; loc < FirstInstanceAttribute; ++loc ) {
+            GLint enabled = 0;
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_ENABLED,
+                                 &enabled );
+            if ( !enabled ) { continue; }
+
+            Attribute a;
+            a.location = loc;
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING,
+                                 &a.buffer );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_SIZE, &a.size );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_TYPE, &a.type );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED,
+                                 &a.normalized );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_STRIDE,
+                                 &a.stride );
+            glGetVertexAttribPointerv( loc, GL_VERTEX_ATTRIB_ARRAY_POINTER,
+                                       &a.pointer );
+            attributes.push_back( a );
+        }
+        GLint ebo = 0;
+        glGetIntegerv( GL_ELEMENT_ARRAY_BUFFER_BINDING, &ebo );
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0,
-			GL_RGB, GL_UNSIGNED_BYTE, pixels);
-		glUniform1i(tex, 0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindVertexArray( vao );
+        for ( auto& a : attributes ) {
+            glBindBuffer( GL_ARRAY_BUFFER, a.buffer );
+            glVertexAttribPointer( a.location, a.size, a.type,
+                                   a.normalized ? GL_TRUE : GL_FALSE,
+                                   a.stride, a.pointer );
+            glEnableVertexAttribArray( a.location );
+        }
+        if ( ebo ) { glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebo ); }
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	}
-	virtual void receive(Traversal*);
+        for ( GLuint i = 0; i < 4; ++i ) {
+            glVertexAttribDivisor( FirstInstanceAttribute + i, 1 );
+            glEnableVertexAttribArray( FirstInstanceAttribute + i );
+        }
+        glBindVertexArray( 0 );
+    }
+
+    // Point the instance attributes at instance data starting at offset
+    //   in buffer
+    void _pointInstances( GLuint buffer, GLintptr offset ) {
+        glBindVertexArray( vao );
+        glBindBuffer( GL_ARRAY_BUFFER, buffer );
+        for ( GLuint i = 0; i < 3; ++i ) {
+            glVertexAttribPointer( FirstInstanceAttribute + i, 4, GL_FLOAT,
+                GL_FALSE, sizeof(Instance),
+                BUFFER_OFFSET( offset + i * sizeof(vec4) ) );
+        }
+        glVertexAttribPointer( FirstInstanceAttribute + 3, 4,
+            GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance),
+            BUFFER_OFFSET( offset + offsetof(Instance, color) ) );
+        glBindVertexArray( 0 );
+    }
 };
+
 struct Cube : public GeometricObject
 {
 	typedef Angel::vec2  vec2;
 	typedef Angel::vec3  vec3;
+	typedef Angel::vec4  vec4;
 
 	GLuint   ebo;  /// vertex index buffer 
 	
@@ -567,6 +952,7 @@ struct Cube : public GeometricObject
 	Cube(const int size = 4, const std::string& vs = "default.vert",
 		const std::string& fs = "Square.frag") :
 		GeometricObject(vs, fs) {
+		type = NodeType::Cube;
 		struct Vertex {
 			vec3  pos;
 		}; //get pen and paper for these
@@ -673,37 +1059,183 @@ struct Cube : public GeometricObject
 			0.820f, 0.883f, 0.371f,
 			0.982f, 0.099f, 0.879f
 		};
-			bbox.ll = vec3(-0, -0, -4.0);
-			bbox.ur = vec3(0.0, 0.0, 10.0);
+			bbox.ll = vec3(-1.0, -1.0, -2.0);
+			bbox.ur = vec3(1.0, 1.0, 0.0);
 		
 		numVertices = vertices.size();
-
-		glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
-			&vertices[0], GL_STATIC_DRAW);
+		const bool compact = VertexFormat::compact();
 
 		GLint vPosition = glGetAttribLocation(program, "vPosition");
-		glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE,
-			sizeof(Vertex), BUFFER_OFFSET(0));
+		if (compact)
+		{
+			std::vector<HalfPosition> halves(numVertices);
+			for (GLsizei i = 0; i < numVertices; ++i)
+				halves[i] = vertices[i].pos;
+			glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(HalfPosition),
+				&halves[0], GL_STATIC_DRAW);
+			glVertexAttribPointer(vPosition, 3, GL_HALF_FLOAT, GL_FALSE,
+				sizeof(HalfPosition), BUFFER_OFFSET(0));
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex),
+				&vertices[0], GL_STATIC_DRAW);
+			glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE,
+				sizeof(Vertex), BUFFER_OFFSET(0));
+		}
 		glEnableVertexAttribArray(vPosition);
 		
 		GLuint colorbuffer;
 		glGenBuffers(1, &colorbuffer);
 		glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
+		if (compact)
+		{
+			const GLsizei numColors = sizeof(g_color_buffer_data) /
+				(3 * sizeof(GLfloat));
+			std::vector<Color8> packed(numColors);
+			for (GLsizei i = 0; i < numColors; ++i)
+			{
+				const GLfloat* c = &g_color_buffer_data[3 * i];
+				packed[i] = vec4(c[0], c[1], c[2], 1.0);
+			}
+			glBufferData(GL_ARRAY_BUFFER, numColors * sizeof(Color8),
+				&packed[0], GL_STATIC_DRAW);
+			glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE,
+				sizeof(Color8), BUFFER_OFFSET(0));
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
+			glVertexAttribPointer(
+				1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
+				3,                                // size
+				GL_FLOAT,                         // type
+				GL_FALSE,                         // normalized?
+				0,                                // stride
+				(void*)0                          // array buffer offset
+				);
+		}
 		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-			);
 		
 	}
 	virtual void receive(Traversal*);
 };
+
+//----------------------------------------------------------------------------
+//
+//  --- Mesh ---
+//
+///  @class Mesh
+///  @brief Geometry loaded from a scene file (see SceneFile.h)
+///  @details The vertex, index and texel blobs are uploaded straight from
+///    the file's memory, which only has to stay mapped until construction
+///    is done.
+
+struct Mesh : public GeometricObject {
+
+    typedef Angel::vec3  vec3;
+
+    std::vector<GLuint>     buffers;  /// vertex streams after the first
+    GLuint                  ebo;      /// element buffer, or 0
+    std::vector<SceneDraw>  draws;
+
+    /// Build the mesh record describes from the blobs in file.  With a
+    ///   key, a mesh already built under it is shared rather than uploaded
+    ///   again, and a new one is cached under it (see MeshCache).
+    Mesh( const SceneMeshRecord& record, const unsigned char* file,
+          const std::string& key = std::string() ) :
+        GeometricObject( record.vertexShader, record.fragmentShader ),
+        buffers(), ebo(0),
+        draws( record.draws, record.draws + record.drawCount ) {
+        type = NodeType::Mesh;
+
+        bbox.ll = vec3( record.ll[0], record.ll[1], record.ll[2] );
+        bbox.ur = vec3( record.ur[0], record.ur[1], record.ur[2] );
+        numVertices = record.numVertices;
+
+        if ( !key.empty() && acquireMesh( key ) ) {
+            buffers = shared->buffers;
+            ebo = shared->ebo;
+        }
+        else {
+            _upload( record, file );
+            if ( !key.empty() ) {
+                shareMesh( key, ebo, std::vector<GLsizei>(), buffers );
+            }
+        }
+
+        // stream 0 is the vbo GeometricObject made (or the shared one)
+        std::vector<GLuint> streams( 1, vbo );
+        streams.insert( streams.end(), buffers.begin(), buffers.end() );
+        for ( uint32_t i = 0; i < record.attributeCount; ++i ) {
+            const SceneAttribute& a = record.attributes[i];
+            glBindBuffer( GL_ARRAY_BUFFER, streams[a.stream] );
+            glVertexAttribPointer( a.location, a.size, a.type,
+                                   a.normalized ? GL_TRUE : GL_FALSE,
+                                   a.stride, BUFFER_OFFSET(size_t(a.offset)) );
+            glVertexAttribDivisor( a.location, a.divisor );
+            glEnableVertexAttribArray( a.location );
+        }
+
+        glBindVertexArray( 0 );
+    }
+
+    virtual ~Mesh() {
+        if ( shared ) { return; }  // the cache deletes shared objects
+        if ( !buffers.empty() ) {
+            glDeleteBuffers( GLsizei( buffers.size() ), &buffers[0] );
+        }
+        if ( ebo ) { glDeleteBuffers( 1, &ebo ); }
+        if ( texture ) { glDeleteTextures( 1, &texture ); }
+    }
+
+    // Function implemented in Traversals.h
+    virtual void receive( Traversal* );
+
+  private:
+    // Create the vertex, element and texture objects and fill them from
+    //   file, with the vao bound
+    void _upload( const SceneMeshRecord& record, const unsigned char* file ) {
+        // stream 0 goes in the vbo GeometricObject made
+        std::vector<GLuint> streams( 1, vbo );
+        for ( uint32_t i = 1; i < record.streamCount; ++i ) {
+            GLuint buffer;
+            glGenBuffers( 1, &buffer );
+            streams.push_back( buffer );
+            buffers.push_back( buffer );
+        }
+        for ( uint32_t i = 0; i < record.streamCount; ++i ) {
+            const SceneBlob& blob = record.streams[i];
+            glBindBuffer( GL_ARRAY_BUFFER, streams[i] );
+            glBufferData( GL_ARRAY_BUFFER, blob.size, file + blob.offset,
+                          GL_STATIC_DRAW );
+        }
+
+        if ( record.indices.size ) {
+            glGenBuffers( 1, &ebo );
+            glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebo );
+            glBufferData( GL_ELEMENT_ARRAY_BUFFER, record.indices.size,
+                          file + record.indices.offset, GL_STATIC_DRAW );
+        }
+
+        if ( record.texels.size ) {
+            glGenTextures( 1, &texture );
+            glBindTexture( GL_TEXTURE_2D, texture );
+            glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+            glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, record.textureWidth,
+                          record.textureHeight, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                          file + record.texels.offset );
+            glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                             GL_CLAMP_TO_BORDER );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                             GL_NEAREST );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                             GL_NEAREST );
+        }
+    }
+};
+
 //----------------------------------------------------------------------------
 
 };  // namespace Scene
@@ -0,0 +1,509 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- StaticBatches.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __STATICBATCHES_H__
+#define __STATICBATCHES_H__
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "Angel.h"
+#include "Frustum.h"
+#include "RenderList.h"
+#include "RenderQueue.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- StaticBatches ---
+//
+/// \class StaticBatches
+/// \brief The static draws of a RenderList merged into shared buffers, so
+///    each group of them is drawn with one multi-draw call
+/// \details build() groups the list's draw records that use default.vert
+///    by fragment shader, texture, polygon mode, blending, primitive type,
+///    index type and vertex layout.  Each group of two or more becomes a
+///    Batch: every node's vertices are copied (in the GL, with
+///    glCopyBufferSubData) into one vertex buffer and each shared index
+///    buffer once into one element buffer, and the records are marked
+///    batched so RenderList::gather() passes over them.
+///
+///    Batches draw with Batched.vert, which reads each vertex's model-view
+///    matrix from a buffer texture holding the scene's MV and a copy of
+///    every transform's world matrix, indexed by a per-vertex attribute.
+///    GL 4.0 has no draw or base instance index to pick a matrix per draw,
+///    hence the copy of the vertices per node; meshes over MaxVertices are
+///    left to draw on their own rather than copied.  gather() uploads the
+///    matrices when any has changed, culls each batched draw against its
+///    transform's frustum as RenderList does, and queues one
+///    glMultiDrawArrays or glMultiDrawElementsBaseVertex per batch with
+///    the draws that survive.
+///
+///    Rebuild after the list is recompiled (structure differs from the
+///    list's).  Use and delete on the GL thread.
+
+struct StaticBatches {
+
+    typedef Angel::mat4  mat4;
+
+    static const GLuint   MatrixAttribute = 7;    /// location of the index
+    static const GLsizei  MaxVertices = 4096;     /// largest mesh copied
+
+    /// Draws sharing a program, state and vertex layout
+    struct Batch {
+        GLuint   program;
+        GLuint   vao;
+        GLuint   texture;
+        GLenum   polygonMode;
+        bool     blend;
+        GLenum   mode;
+        GLenum   indexType;    /// 0 for glMultiDrawArrays
+        GLuint   buffers[3];   /// vertices, matrix indices, elements
+
+        // per draw, in record order
+        std::vector<int>      records;       /// draw record in the list
+        std::vector<GLint>    firsts;        /// first vertex (arrays)
+        std::vector<GLsizei>  counts;        /// vertex or index count
+        std::vector<GLvoid*>  offsets;       /// element offset (elements)
+        std::vector<GLint>    baseVertices;  /// vertex copy (elements)
+
+        // the draws queued by the last gather()
+        std::vector<GLint>    drawFirsts;
+        std::vector<GLsizei>  drawCounts;
+        std::vector<GLvoid*>  drawOffsets;
+        std::vector<GLint>    drawBaseVertices;
+    };
+
+    std::vector<Batch>  batches;
+    unsigned long       structure;  /// RenderList::structure batched
+    size_t              records;    /// draw records merged into batches
+    size_t              bytes;      /// vertex, index and matrix index
+                                    ///   buffer memory
+
+    StaticBatches() : batches(), structure(0), records(0), bytes(0),
+        uploaded(), uploadedMV(0) {
+        glGenBuffers( 1, &matrices );
+        glGenTextures( 1, &matrixTexture );
+        glBindBuffer( GL_TEXTURE_BUFFER, matrices );
+        glBufferData( GL_TEXTURE_BUFFER, sizeof(mat4), NULL, GL_STREAM_DRAW );
+        glBindTexture( GL_TEXTURE_BUFFER, matrixTexture );
+        glTexBuffer( GL_TEXTURE_BUFFER, GL_RGBA32F, matrices );
+        glBindTexture( GL_TEXTURE_BUFFER, 0 );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+    }
+
+    ~StaticBatches() {
+        _clear();
+        glDeleteTextures( 1, &matrixTexture );
+        glDeleteBuffers( 1, &matrices );
+    }
+
+    StaticBatches( const StaticBatches& ) = delete;
+    StaticBatches& operator = ( const StaticBatches& ) = delete;
+
+    /// Merge list's batchable draw records, replacing any earlier batches
+    void build( RenderList& list ) {
+        _clear();
+        structure = list.structure;
+        list.batched.assign( list.size(), 0 );
+
+        // group the records, reading each vertex array's layout once
+        std::map<GLuint, Layout>  layouts;
+        std::vector<Group>        groups;
+        for ( size_t i = 0; i < list.size(); ++i ) {
+            if ( list.instances[i] ) { continue; }
+
+            const char* vs;
+            const char* fs;
+            if ( !Angel::ProgramShaderFiles( list.program[i], vs, fs ) ||
+                 !_isDefaultVertexShader( vs ) ) {
+                continue;
+            }
+
+            auto l = layouts.find( list.vao[i] );
+            if ( l == layouts.end() ) {
+                l = layouts.insert( std::make_pair( list.vao[i],
+                                        _layout( list.vao[i] ) ) ).first;
+            }
+            if ( !l->second.batchable ) { continue; }
+
+            Group* g = NULL;
+            for ( auto& candidate : groups ) {
+                if ( candidate.fragmentShader == fs &&
+                     _sameState( list, candidate.records[0], int( i ) ) &&
+                     _sameLayout( *candidate.layout, l->second ) ) {
+                    g = &candidate;
+                    break;
+                }
+            }
+            if ( !g ) {
+                groups.push_back( Group() );
+                g = &groups.back();
+                g->fragmentShader = fs;
+                g->layout = &l->second;
+            }
+            g->records.push_back( int( i ) );
+        }
+
+        for ( auto& g : groups ) {
+            if ( g.records.size() < 2 ) { continue; }
+            _build( list, g, layouts );
+        }
+    }
+
+    /// Queue the batched draws whose bounds intersect the view volume.
+    ///   The list's matrices must be up to date (RenderList::update()) for
+    ///   the scene's MV, whose version is given.
+    void gather( const RenderList& list, const mat4& MV,
+                 unsigned long version, const ViewFrustum& sceneFrustum,
+                 bool cull, RenderQueue& queue ) {
+        if ( batches.empty() ) { return; }
+        _upload( list, MV, version );
+
+        glActiveTexture( GL_TEXTURE1 );
+        glBindTexture( GL_TEXTURE_BUFFER, matrixTexture );
+        glActiveTexture( GL_TEXTURE0 );
+
+        for ( auto& b : batches ) {
+            b.drawFirsts.clear();
+            b.drawCounts.clear();
+            b.drawOffsets.clear();
+            b.drawBaseVertices.clear();
+
+            for ( size_t k = 0; k < b.records.size(); ++k ) {
+                int r = b.records[k];
+                int t = list.transform[r];
+                if ( cull ) {
+                    const ViewFrustum& f = t < 0 ? sceneFrustum :
+                                                   list.frustums[t];
+                    if ( !f.intersects( list.bounds[r] ) ) {
+                        ++queue.stats.nodesCulled;
+                        continue;
+                    }
+                }
+                ++queue.stats.nodesVisible;
+
+                b.drawCounts.push_back( b.counts[k] );
+                if ( b.indexType ) {
+                    b.drawOffsets.push_back( b.offsets[k] );
+                    b.drawBaseVertices.push_back( b.baseVertices[k] );
+                }
+                else {
+                    b.drawFirsts.push_back( b.firsts[k] );
+                }
+            }
+            if ( b.drawCounts.empty() ) { continue; }
+
+            DrawItem item;
+            item.program = b.program;
+            item.vao = b.vao;
+            item.texture = b.texture;
+            item.polygonMode = b.polygonMode;
+            item.blend = b.blend;
+            item.usesMV = false;
+            item.mode = b.mode;
+            item.indexType = b.indexType;
+            item.multi( GLsizei( b.drawCounts.size() ), &b.drawCounts[0],
+                        b.indexType ? NULL : &b.drawFirsts[0],
+                        b.indexType ? &b.drawOffsets[0] : NULL,
+                        b.indexType ? &b.drawBaseVertices[0] : NULL );
+            queue.add( item );
+        }
+    }
+
+  private:
+    // A vertex array whose attributes all read one interleaved buffer
+    struct Attribute {
+        GLint    location, size, type, normalized, integer;
+        GLsizei  offset;  // within a vertex
+    };
+    struct Layout {
+        bool                    batchable;
+        GLint                   buffer;
+        GLsizei                 stride;
+        GLsizei                 vertices;  // in the buffer
+        GLint                   elements;  // element buffer, or 0
+        std::vector<Attribute>  attributes;
+    };
+    struct Group {
+        std::string        fragmentShader;
+        const Layout*      layout;
+        std::vector<int>   records;
+    };
+
+    GLuint                      matrices;       // MV and the world matrices
+    GLuint                      matrixTexture;  // matrices as a texture
+    std::vector<unsigned long>  uploaded;       // versions of the worlds in
+                                                //   matrices
+    unsigned long               uploadedMV;     // version of the MV in it
+
+    void _clear() {
+        for ( auto& b : batches ) {
+            glDeleteVertexArrays( 1, &b.vao );
+            glDeleteBuffers( 3, b.buffers );
+            Angel::ReleaseProgram( b.program );
+        }
+        batches.clear();
+        records = bytes = 0;
+        uploaded.clear();
+        uploadedMV = 0;
+    }
+
+    static bool _isDefaultVertexShader( const std::string& path ) {
+        std::string name = path.substr( path.find_last_of( "/\\" ) + 1 );
+        return name == "default.vert";
+    }
+
+    static bool _sameState( const RenderList& list, int a, int b ) {
+        return list.texture[a] == list.texture[b] &&
+            list.polygonMode[a] == list.polygonMode[b] &&
+            list.blend[a] == list.blend[b] && list.mode[a] == list.mode[b] &&
+            list.indexType[a] == list.indexType[b];
+    }
+
+    static bool _sameLayout( const Layout& a, const Layout& b ) {
+        if ( a.stride != b.stride ||
+             a.attributes.size() != b.attributes.size() ) {
+            return false;
+        }
+        for ( size_t i = 0; i < a.attributes.size(); ++i ) {
+            if ( memcmp( &a.attributes[i], &b.attributes[i],
+                         sizeof(Attribute) ) != 0 ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static GLsizei _typeSize( GLenum type ) {
+        switch ( type ) {
+            case GL_BYTE: case GL_UNSIGNED_BYTE:                 return 1;
+            case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT:
+                                                                 return 2;
+            case GL_DOUBLE:                                      return 8;
+            default:                                             return 4;
+        }
+    }
+
+    // Read vao's vertex layout back from the GL
+    static Layout _layout( GLuint vao ) {
+        Layout l;
+        l.batchable = false;
+        l.buffer = 0;
+        l.stride = 0;
+        l.vertices = 0;
+        l.elements = 0;
+
+        GLint maxAttributes = 0;
+        glGetIntegerv( GL_MAX_VERTEX_ATTRIBS, &maxAttributes );
+
+        glBindVertexArray( vao );
+        for ( GLint loc = 0; loc < maxAttributes; ++loc ) {
+            GLint enabled = 0;
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_ENABLED,
+                                 &enabled );
+            if ( !enabled ) { continue; }
+
+            GLint buffer, stride, divisor;
+            GLvoid* pointer;
+            Attribute a;
+            a.location = loc;
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING,
+                                 &buffer );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_SIZE, &a.size );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_TYPE, &a.type );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED,
+                                 &a.normalized );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_INTEGER,
+                                 &a.integer );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &stride );
+            glGetVertexAttribiv( loc, GL_VERTEX_ATTRIB_ARRAY_DIVISOR,
+                                 &divisor );
+            glGetVertexAttribPointerv( loc, GL_VERTEX_ATTRIB_ARRAY_POINTER,
+                                       &pointer );
+            if ( !stride ) { stride = a.size * _typeSize( a.type ); }
+            a.offset = GLsizei( (size_t) pointer );
+
+            // one interleaved buffer, no instancing, and our location free
+            if ( GLuint( loc ) == MatrixAttribute || divisor || !buffer ||
+                 (l.buffer && (buffer != l.buffer || stride != l.stride)) ||
+                 a.offset >= stride ) {
+                glBindVertexArray( 0 );
+                return l;
+            }
+            l.buffer = buffer;
+            l.stride = stride;
+            l.attributes.push_back( a );
+        }
+        glGetIntegerv( GL_ELEMENT_ARRAY_BUFFER_BINDING, &l.elements );
+        glBindVertexArray( 0 );
+        if ( !l.buffer ) { return l; }
+
+        GLint size = 0;
+        glBindBuffer( GL_COPY_READ_BUFFER, l.buffer );
+        glGetBufferParameteriv( GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size );
+        glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+
+        l.vertices = size / l.stride;
+        l.batchable = l.vertices > 0 && l.vertices <= MaxVertices;
+        return l;
+    }
+
+    static GLsizeiptr _bufferSize( GLint buffer ) {
+        GLint size = 0;
+        glBindBuffer( GL_COPY_READ_BUFFER, buffer );
+        glGetBufferParameteriv( GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size );
+        glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+        return size;
+    }
+
+    // Merge a group's records into a new batch
+    void _build( RenderList& list, const Group& g,
+                 const std::map<GLuint, Layout>& layouts ) {
+        const Layout& layout = *g.layout;
+        int first = g.records[0];
+
+        Batch b;
+        b.program = Angel::AcquireProgram( "Batched.vert",
+                                           g.fragmentShader.c_str() );
+        glUseProgram( b.program );
+        glUniform1i( glGetUniformLocation( b.program, "matrices" ), 1 );
+        glUseProgram( 0 );
+
+        b.texture = list.texture[first];
+        b.polygonMode = list.polygonMode[first];
+        b.blend = list.blend[first] != 0;
+        b.mode = list.mode[first];
+        b.indexType = list.indexType[first];
+
+        // place a copy of each node's vertices under each transform it is
+        //   drawn under (each copy carries its own matrix index), and one
+        //   of each element buffer
+        typedef std::pair<GLuint, int>  Placement;    // vao and transform
+        std::map<Placement, GLint>    vertexCopies;   // to base vertex
+        std::map<GLint, GLsizeiptr>   elementCopies;  // buffer to offset
+        std::vector<GLint>            matrixIndices;
+        GLsizeiptr                    elementBytes = 0;
+        for ( int r : g.records ) {
+            GLuint vao = list.vao[r];
+            const Layout& l = layouts.find( vao )->second;
+
+            Placement placement( vao, list.transform[r] );
+            auto v = vertexCopies.find( placement );
+            if ( v == vertexCopies.end() ) {
+                GLint base = GLint( matrixIndices.size() );
+                v = vertexCopies.insert(
+                    std::make_pair( placement, base ) ).first;
+                matrixIndices.resize( base + l.vertices,
+                                      list.transform[r] + 1 );
+            }
+
+            if ( b.indexType ) {
+                auto e = elementCopies.find( l.elements );
+                if ( e == elementCopies.end() ) {
+                    e = elementCopies.insert(
+                        std::make_pair( l.elements, elementBytes ) ).first;
+                    elementBytes += (_bufferSize( l.elements ) + 3) & ~3;
+                }
+                b.offsets.push_back( BUFFER_OFFSET( e->second +
+                                                    list.offset[r] ) );
+                b.baseVertices.push_back( v->second );
+            }
+            else {
+                b.firsts.push_back( v->second + list.first[r] );
+            }
+            b.records.push_back( r );
+            b.counts.push_back( list.count[r] );
+            list.batched[r] = 1;
+        }
+
+        GLsizeiptr vertexBytes = GLsizeiptr( matrixIndices.size() ) *
+            layout.stride;
+
+        glGenVertexArrays( 1, &b.vao );
+        glBindVertexArray( b.vao );
+        glGenBuffers( 3, b.buffers );
+
+        glBindBuffer( GL_ARRAY_BUFFER, b.buffers[0] );
+        glBufferData( GL_ARRAY_BUFFER, vertexBytes, NULL, GL_STATIC_DRAW );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, b.buffers[0] );
+        for ( auto& v : vertexCopies ) {
+            const Layout& l = layouts.find( v.first.first )->second;
+            glBindBuffer( GL_COPY_READ_BUFFER, l.buffer );
+            glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                 0, GLintptr( v.second ) * layout.stride,
+                                 GLsizeiptr( l.vertices ) * layout.stride );
+        }
+        for ( auto& a : layout.attributes ) {
+            if ( a.integer ) {
+                glVertexAttribIPointer( a.location, a.size, a.type,
+                    layout.stride, BUFFER_OFFSET( size_t( a.offset ) ) );
+            }
+            else {
+                glVertexAttribPointer( a.location, a.size, a.type,
+                    a.normalized ? GL_TRUE : GL_FALSE, layout.stride,
+                    BUFFER_OFFSET( size_t( a.offset ) ) );
+            }
+            glEnableVertexAttribArray( a.location );
+        }
+
+        glBindBuffer( GL_ARRAY_BUFFER, b.buffers[1] );
+        glBufferData( GL_ARRAY_BUFFER, matrixIndices.size() * sizeof(GLint),
+                      &matrixIndices[0], GL_STATIC_DRAW );
+        glVertexAttribIPointer( MatrixAttribute, 1, GL_INT, 0,
+                                BUFFER_OFFSET(0) );
+        glEnableVertexAttribArray( MatrixAttribute );
+
+        if ( b.indexType ) {
+            glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, b.buffers[2] );
+            glBufferData( GL_ELEMENT_ARRAY_BUFFER, elementBytes, NULL,
+                          GL_STATIC_DRAW );
+            glBindBuffer( GL_COPY_WRITE_BUFFER, b.buffers[2] );
+            for ( auto& e : elementCopies ) {
+                GLsizeiptr size = _bufferSize( e.first );
+                glBindBuffer( GL_COPY_READ_BUFFER, e.first );
+                glCopyBufferSubData( GL_COPY_READ_BUFFER,
+                    GL_COPY_WRITE_BUFFER, 0, e.second, size );
+            }
+        }
+        glBindVertexArray( 0 );
+        glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+        records += b.records.size();
+        bytes += size_t( vertexBytes + elementBytes ) +
+            matrixIndices.size() * sizeof(GLint);
+        batches.push_back( b );
+    }
+
+    // Store MV and the list's world matrices in the matrix buffer, if any
+    //   has changed since the last upload
+    void _upload( const RenderList& list, const mat4& MV,
+                  unsigned long version ) {
+        if ( version == uploadedMV && uploaded == list.versions ) { return; }
+
+        std::vector<mat4> data( list.worlds.size() + 1 );
+        data[0] = MV;
+        std::copy( list.worlds.begin(), list.worlds.end(), data.begin() + 1 );
+
+        glBindBuffer( GL_TEXTURE_BUFFER, matrices );
+        glBufferData( GL_TEXTURE_BUFFER, data.size() * sizeof(mat4),
+                      &data[0], GL_STREAM_DRAW );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+
+        uploaded = list.versions;
+        uploadedMV = version;
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __STATICBATCHES_H__
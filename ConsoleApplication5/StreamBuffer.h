@@ -0,0 +1,132 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- StreamBuffer.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __STREAMBUFFER_H__
+#define __STREAMBUFFER_H__
+
+#include <cassert>
+#include <cstring>
+#include "Angel.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- StreamBuffer ---
+//
+/// \class StreamBuffer
+/// \brief A ring of buffer regions for data that is rewritten every frame
+/// \details The buffer object is allocated once with room for NumRegions
+///    copies of the per-frame data.  Each write() moves to the next region,
+///    waits on the fence placed when that region was last drawn from (which
+///    only blocks if the GL is NumRegions frames behind), and copies the
+///    data in without re-specifying or orphaning the buffer.  When
+///    ARB_buffer_storage is available the buffer is mapped persistently
+///    once; otherwise each region is mapped unsynchronized, since the fence
+///    already guarantees the GL is done with it.
+///
+///    Usage, once per frame:
+///      GLintptr offset = stream.write( data, size );
+///      ... point attributes at offset and draw ...
+///      stream.fence();
+
+struct StreamBuffer {
+
+    static const int NumRegions = 3;
+
+    GLenum      target;      /// buffer binding target
+    GLuint      buffer;      /// buffer object handle
+    GLsizeiptr  regionSize;  /// bytes available per write()
+    int         region;      /// region written by the last write()
+    GLsync      fences[NumRegions];
+    GLubyte*    mapped;      /// persistent mapping, or NULL
+
+    StreamBuffer( GLenum target, GLsizeiptr regionSize ) :
+        target(target), buffer(0), regionSize(regionSize), region(0),
+        mapped(NULL) {
+
+        for ( int i = 0; i < NumRegions; ++i ) { fences[i] = 0; }
+
+        GLsizeiptr size = NumRegions * regionSize;
+
+        glGenBuffers( 1, &buffer );
+        glBindBuffer( target, buffer );
+
+        if ( GLEW_ARB_buffer_storage ) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                GL_MAP_COHERENT_BIT;
+            glBufferStorage( target, size, NULL, flags );
+            mapped = (GLubyte*) glMapBufferRange( target, 0, size, flags );
+        }
+        else {
+            glBufferData( target, size, NULL, GL_STREAM_DRAW );
+        }
+    }
+
+    ~StreamBuffer() {
+        for ( int i = 0; i < NumRegions; ++i ) {
+            if ( fences[i] ) { glDeleteSync( fences[i] ); }
+        }
+        if ( mapped ) {
+            glBindBuffer( target, buffer );
+            glUnmapBuffer( target );
+        }
+        glDeleteBuffers( 1, &buffer );
+    }
+
+    /// Copy size bytes into the next region and return its offset in buffer.
+    ///   size must not exceed regionSize; a caller whose data can outgrow
+    ///   the regions replaces the StreamBuffer with a larger one first.
+    ///   The buffer is left bound to target.
+    GLintptr write( const void* data, GLsizeiptr size ) {
+        region = (region + 1) % NumRegions;
+        GLintptr offset = region * regionSize;
+
+        if ( fences[region] ) {
+            glClientWaitSync( fences[region], GL_SYNC_FLUSH_COMMANDS_BIT,
+                              GLuint64(-1) );
+            glDeleteSync( fences[region] );
+            fences[region] = 0;
+        }
+
+        assert( size <= regionSize );
+        glBindBuffer( target, buffer );
+
+        if ( mapped ) {
+            memcpy( mapped + offset, data, size );
+        }
+        else {
+            void* dst = glMapBufferRange( target, offset, size,
+                GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+                GL_MAP_INVALIDATE_RANGE_BIT );
+            memcpy( dst, data, size );
+            glUnmapBuffer( target );
+        }
+
+        bytesStreamed() += size;
+        return offset;
+    }
+
+    /// Mark the region from the last write() as in use by the commands
+    ///   issued so far
+    void fence() {
+        if ( fences[region] ) { glDeleteSync( fences[region] ); }
+        fences[region] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    }
+
+    /// Running total of bytes written by all stream buffers; the frame loop
+    ///   reads and resets it once per frame
+    static GLsizeiptr& bytesStreamed() {
+        static GLsizeiptr  bytes = 0;
+        return bytes;
+    }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __STREAMBUFFER_H__
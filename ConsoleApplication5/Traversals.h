@@ -8,9 +8,17 @@
 #define __TRAVERSALS_H__
 
 
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "Frustum.h"
 #include "Nodes.h"
+#include "OcclusionCuller.h"
+#include "RenderList.h"
+#include "RenderQueue.h"
 #include "Shapes.h"
 #include "SceneGraph.h"
+#include "StaticBatches.h"
 
 namespace Scene {
 
@@ -19,7 +27,11 @@ namespace Scene {
 //  --- Traversal ---
 //
 /// \class Traversal
-/// \brief Base class of all traversals
+/// \brief Base class of traversals dispatched through virtual calls
+/// \details Each visit costs two virtual calls, Node::receive() and then
+///    visit(), and neither can be inlined.  The traversals below derive
+///    from StaticTraversal instead; this path remains for traversals that
+///    need to be chosen at run time.
 
 struct GeometricObject;
 
@@ -45,7 +57,9 @@ struct Traversal {
 	virtual void visit(Sphere*) {}
     virtual void visit( Transform* ) {}
 	virtual void visit(SphereLines*) {}
-	virtual void visit(LineQuad*) {}
+    virtual void visit( InstancedGeometry* ) {}
+    virtual void visit( Mesh* ) {}
+    virtual void visit( LOD* ) {}
 };
 
 void Cone::receive( Traversal* t ) { t->visit( this ); }
@@ -53,9 +67,76 @@ void GroundPlane::receive( Traversal* t ) { t->visit( this ); }
 void Cube::receive( Traversal* t ) { t->visit(this); }
 void Sphere::receive(Traversal* t) { t->visit(this); }
 void SphereLines::receive(Traversal* t) { t->visit(this); }
-void LineQuad::receive(Traversal* t) { t->visit(this); }
+void InstancedGeometry::receive( Traversal* t ) { t->visit( this ); }
 void GeometricObject::receive( Traversal* t ) { t->visit( this ); }
 void Transform::receive( Traversal* t ) { t->visit( this ); }
+void Mesh::receive( Traversal* t ) { t->visit( this ); }
+void LOD::receive( Traversal* t ) { t->visit( this ); }
+
+/// Call v.visit() with n cast to its concrete type.  The call is resolved
+///   against V when the template is instantiated, so V's visits can be
+///   inlined into the switch.
+template <class V>
+inline void dispatch( Node* n, V& v )
+{
+    switch ( n->type ) {
+        case NodeType::GeometricObject:
+            v.visit( static_cast<GeometricObject*>( n ) ); break;
+        case NodeType::Cone:
+            v.visit( static_cast<Cone*>( n ) ); break;
+        case NodeType::GroundPlane:
+            v.visit( static_cast<GroundPlane*>( n ) ); break;
+        case NodeType::Cube:
+            v.visit( static_cast<Cube*>( n ) ); break;
+        case NodeType::Sphere:
+            v.visit( static_cast<Sphere*>( n ) ); break;
+        case NodeType::SphereLines:
+            v.visit( static_cast<SphereLines*>( n ) ); break;
+        case NodeType::InstancedGeometry:
+            v.visit( static_cast<InstancedGeometry*>( n ) ); break;
+        case NodeType::Mesh:
+            v.visit( static_cast<Mesh*>( n ) ); break;
+        case NodeType::Transform:
+            v.visit( static_cast<Transform*>( n ) ); break;
+        case NodeType::LOD:
+            v.visit( static_cast<LOD*>( n ) ); break;
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+//  --- StaticTraversal ---
+//
+/// \class StaticTraversal
+/// \brief Base class of traversals dispatched at compile time
+/// \details Derived is the traversal itself, which declares non-virtual
+///    visits for the node types it handles and brings this class's visit
+///    into scope with a using declaration.  Overload resolution then picks
+///    the visit for the most derived type it has, so a visit for
+///    GeometricObject serves every shape without one of its own, and nodes
+///    with no match at all reach the empty visit( Node* ), so a new shape
+///    needs no changes here beyond its case in dispatch().
+
+template <class Derived>
+struct StaticTraversal {
+
+    SceneGraph* scene;
+
+    StaticTraversal() : scene(NULL) {}
+
+    void traverse( SceneGraph* s ) {
+        scene = s;
+        for ( auto n : s->nodes ) {
+            visitNode( n );
+        }
+    }
+
+    /// Visit n as its concrete type
+    void visitNode( Node* n )
+        { dispatch( n, static_cast<Derived&>( *this ) ); }
+
+    void visit( Node* ) {}
+};
 
 
 //----------------------------------------------------------------------------
@@ -64,39 +145,93 @@ void Transform::receive( Traversal* t ) { t->visit( this ); }
 //
 /// \class BoundingBoxTraversal
 /// \brief A traversal that will compute the bounding box of the entire scene
+/// \details Each node's box is transformed by the product of the Transforms
+///    above it, so bbox is in the frame of the scene graph's top-level
+///    nodes.  A Transform with at least grain children has them split
+///    across worker threads, each with its own traversal, and the workers'
+///    boxes are merged once they finish.  Workers don't split further.
 
-struct BoundingBoxTraversal : public Traversal {
+struct BoundingBoxTraversal : public StaticTraversal<BoundingBoxTraversal> {
 
-    BBox  bbox;  /// Bounding box of entire scene
+    typedef Angel::mat4  mat4;
 
-    virtual void visit( Cone* node )
-        { bbox = bbox.merge( node->bbox ); }
-    
-	virtual void visit(GroundPlane* node)
-	{
-		bbox = bbox.merge(node->bbox);
-	}
-	virtual void visit(Sphere* node)
-	{
-		bbox = bbox.merge(node->bbox);
-	}
-	virtual void visit(SphereLines* node)
-	{
-		bbox = bbox.merge(node->bbox);
-	}
-	virtual void visit(LineQuad* node)
-	{
-		bbox = bbox.merge(node->bbox);
-	}
-    virtual void visit( GeometricObject* node )
-        { bbox = bbox.merge( node->bbox ); }
-	virtual void visit(Cube* node)
-	{
-		bbox = bbox.merge(node->bbox);
-	}
-    virtual void visit( Transform* node ) {
-        for ( auto n : node->nodes ) {
-            n->receive( this );
+    using StaticTraversal<BoundingBoxTraversal>::visit;
+
+    BBox      bbox;     /// Bounding box of entire scene
+    bool      empty;    /// no geometry was found, so bbox is meaningless
+    unsigned  threads;  /// most threads to use, or 0 for one per core
+    size_t    grain;    /// fewest children worth splitting across threads
+
+    BoundingBoxTraversal() : bbox(), empty(true), threads(0), grain(1024),
+        matrix(), worker(false), maxThreads(1) {}
+
+    void traverse( SceneGraph* s ) {
+        scene = s;
+        bbox = BBox();
+        empty = true;
+        matrix = mat4();
+        maxThreads = threads ? threads : std::thread::hardware_concurrency();
+        _visitNodes( s->nodes );
+    }
+
+    void visit( GeometricObject* node )
+        { _merge( node->bbox ); }
+    void visit( LOD* node ) {
+        for ( auto n : node->levels ) {
+            visitNode( n );
+        }
+    }
+    void visit( Transform* node ) {
+        mat4 parent = matrix;
+        matrix = parent * node->xform;
+        _visitNodes( node->nodes );
+        matrix = parent;
+    }
+
+  private:
+    mat4    matrix;      // product of the transforms above the current node
+    bool    worker;      // running on a worker thread
+    size_t  maxThreads;  // threads, or the number of cores
+
+    void _merge( const BBox& b ) {
+        BBox world = b.transform( matrix );
+        bbox = empty ? world : bbox.merge( world );
+        empty = false;
+    }
+
+    void _visitNodes( const std::vector<Node*>& nodes ) {
+        size_t n = std::min( maxThreads,
+                             nodes.size() / std::max<size_t>( grain, 1 ) );
+
+        if ( worker || n < 2 ) {
+            for ( auto node : nodes ) {
+                visitNode( node );
+            }
+            return;
+        }
+
+        std::vector<BoundingBoxTraversal>  workers( n, *this );
+        std::vector<std::thread>           pool;
+        for ( size_t i = 0; i < n; ++i ) {
+            BoundingBoxTraversal* w = &workers[i];
+            w->worker = true;
+            w->empty = true;
+
+            size_t first = nodes.size() * i / n;
+            size_t last = nodes.size() * (i + 1) / n;
+            pool.push_back( std::thread( [w, &nodes, first, last]() {
+                for ( size_t j = first; j < last; ++j ) {
+                    w->visitNode( nodes[j] );
+                }
+            } ) );
+        }
+
+        for ( size_t i = 0; i < n; ++i ) {
+            pool[i].join();
+            if ( !workers[i].empty ) {
+                bbox = empty ? workers[i].bbox : bbox.merge( workers[i].bbox );
+                empty = false;
+            }
         }
     }
 };
@@ -107,126 +242,389 @@ struct BoundingBoxTraversal : public Traversal {
 //
 /// \class RenderTraversal
 /// \brief A traversal that will render all of the nodes in the scene
-
-struct RenderTraversal : public Traversal {
+/// \details Visiting a node only queues its draws; once the whole scene
+///    has been visited the queue is sorted by state and submitted.  Nodes
+///    whose bounds lie outside the view frustum are skipped along with
+///    everything beneath them.  The model-view matrix and frustum under
+///    each Transform come from its cache, and are only recomputed when
+///    that transform or one above it has changed.
+///
+///    gather() splits the children of a Transform with at least grain of
+///    them across worker threads, as BoundingBoxTraversal does.  Each worker
+///    fills its own queue, and the queues are appended in order once the
+///    workers are joined.  Workers make no GL calls: dynamic nodes, whose
+///    visits animate them through the GL, are set aside with their
+///    model-view matrix and visited on the calling thread after the join.
+///
+///    An LOD node draws the one level chosen from its size on screen, which
+///    is measured from its bounds, the projection and viewportHeight.
+///
+///    With occlusion set, gather() also skips Transforms whose subtrees
+///    were hidden behind other geometry when last tested, and submit()
+///    tests the transforms that are due once the frame's draws are in the
+///    depth buffer (see OcclusionCuller).  gatherFlat() doesn't use it.
+///
+///    With batches set, gatherFlat() draws the list's static draws through
+///    them, rebuilding them whenever the list is recompiled.
+
+struct RenderTraversal : public StaticTraversal<RenderTraversal> {
 
     typedef Angel::mat4  mat4;
-    
-    virtual void visit( Cone* node ) {
-        glBindVertexArray( node->vao );
-        glUseProgram( node->program );
 
-        glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+    using StaticTraversal<RenderTraversal>::visit;
+
+    RenderQueue         queue;      /// draws gathered from the scene this frame
+    bool                cull;       /// skip nodes outside the view frustum
+
+    const mat4*         modelView;  /// model-view matrix for the current node
+    unsigned long       mvVersion;  /// version of *modelView
+    const ViewFrustum*  frustum;    /// view volume in modelView's frame
+    ViewFrustum         sceneFrustum;
+
+    unsigned            threads;    /// most gather threads, or 0 for one per
+                                    ///   core
+    size_t              grain;      /// fewest children worth splitting
+                                    ///   across threads
+    GLfloat             viewportHeight;  /// pixels, for choosing LOD levels
+    OcclusionCuller*    occlusion;  /// occlusion culling state kept across
+                                    ///   frames, or NULL for none
+    StaticBatches*      batches;    /// merged static draws for
+                                    ///   gatherFlat(), or NULL for none
+
+    RenderTraversal() : cull(true), modelView(NULL), mvVersion(0),
+        frustum(NULL), threads(0), grain(1024), viewportHeight(512),
+        occlusion(NULL), batches(NULL), compiling(NULL),
+        transformIndex(-1), worker(false), maxThreads(1) {}
+
+    void traverse( SceneGraph* s ) {
+        gather( s );
+        submit();
+    }
 
-        glUniformMatrix4fv( node->uP, 1, GL_TRUE, scene->P );
-        glUniformMatrix4fv( node->uMV, 1, GL_TRUE, scene->MV );
-        
-        glDrawArrays( GL_TRIANGLE_FAN, 0, node->numVertices );
-        glDrawElements( GL_TRIANGLE_FAN, node->numConeVerties,
-                        GL_UNSIGNED_INT, BUFFER_OFFSET(0) );
+    /// Walk the scene graph, queueing the draws of the visible nodes
+    void gather( SceneGraph* s ) {
+        _begin( s );
+        occlusionTests.clear();
+        if ( occlusion && !compiling ) { occlusion->beginFrame(); }
+        _visitNodes( s->nodes );
+    }
 
-        size_t offset = node->numConeVerties * sizeof(GLuint);
-        glDrawElements( GL_TRIANGLE_FAN, node->numBaseVertices,
-                        GL_UNSIGNED_INT, BUFFER_OFFSET(offset) );
+    /// Queue the visible draws from list, recompiling it from the scene
+    ///   graph first if nodes have been added since it was built
+    void gatherFlat( SceneGraph* s, RenderList& list ) {
+        if ( list.stale() ) { compile( s, list ); }
+        if ( batches && batches->structure != list.structure ) {
+            batches->build( list );
+        }
+
+        _begin( s );
+        list.update( s->MV, mvVersion, s->P, queue.stats );
+        list.gather( s->MV, sceneFrustum, cull, queue );
+        if ( batches ) {
+            batches->gather( list, s->MV, mvVersion, sceneFrustum, cull,
+                             queue );
+        }
+
+        for ( size_t i = 0; i < list.dynamicNodes.size(); ++i ) {
+            int t = list.dynamicTransforms[i];
+            modelView = t < 0 ? &s->MV : &list.worlds[t];
+            frustum = t < 0 ? &sceneFrustum : &list.frustums[t];
+            ++queue.stats.nodesVisible;
+            visitNode( list.dynamicNodes[i] );
+        }
     }
 
-    virtual void visit( GeometricObject* node ) {
-        glBindVertexArray( node->vao );
-        glUseProgram( node->program );
+    /// Rebuild list from the scene graph
+    void compile( SceneGraph* s, RenderList& list ) {
+        list.clear();
+
+        bool wasCulling = cull;
+        cull = false;
+        compiling = &list;
+        transformIndex = -1;
 
-        glDrawArrays( GL_TRIANGLE_FAN, 0, node->numVertices );
+        gather( s );
 
-        glUseProgram( 0 );
-        glBindVertexArray( 0 );
+        compiling = NULL;
+        cull = wasCulling;
+        queue.clear();
+        list.structure = structureVersion();
     }
-	virtual void visit(GroundPlane* node)
-	{
-		glBindVertexArray(node->vao);
-		glUseProgram(node->program);
 
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    /// Sort and issue the queued draws
+    void submit() {
+        if ( occlusion ) { occlusion->prepare( occlusionTests ); }
+        queue.submit( scene->P );
+        if ( occlusion ) {
+            occlusion->issue( occlusionTests, queue.stats );
+            occlusionTests.clear();
+        }
+    }
+
+    /// Counts of the GL calls issued by the last gather() and submit()
+    const RenderStats& stats() const
+        { return queue.stats; }
+    
+    void visit( Cone* node ) {
+        DrawItem item( node, *modelView, GL_LINE );
+        
+        queue.add( item.arrays( GL_TRIANGLE_FAN, 0, node->numVertices ) );
+        queue.add( item.elements( GL_TRIANGLE_FAN, node->numConeVerties, 0 ) );
 
-		glUniformMatrix4fv(node->uP, 1, GL_TRUE, scene->P);
-		glUniformMatrix4fv(node->uMV, 1, GL_TRUE, scene->MV);
+        size_t offset = node->numConeVerties * sizeof(GLuint);
+        queue.add( item.elements( GL_TRIANGLE_FAN, node->numBaseVertices,
+                                  offset ) );
+    }
 
-		glDrawArrays(GL_TRIANGLE_FAN, 0, node->numVertices);	
-	}
-	virtual void visit(SphereLines* node)
+    void visit( GeometricObject* node ) {
+        DrawItem item( node, *modelView, 0 );
+        queue.add( item.arrays( GL_TRIANGLE_FAN, 0, node->numVertices ) );
+    }
+	void visit(GroundPlane* node)
 	{
-		glEnable(GL_BLEND);
-		
-		int start = 0;
-		node->update(&start);
-		node->update(&start);
-		node->update(&start);
-		node->update(&start);
-		node->update(&start);
-		glBindVertexArray(node->vao);
-		glUseProgram(node->program);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-		glUniformMatrix4fv(node->uP, 1, GL_TRUE, scene->P);
-		glUniformMatrix4fv(node->uMV, 1, GL_TRUE, scene->MV);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, node->numVertices);
-		
-
-		glDisable(GL_BLEND);
+		DrawItem item(node, *modelView, GL_FILL);
+		queue.add(item.arrays(GL_TRIANGLE_FAN, 0, node->numVertices));
 	}
-	virtual void visit(LineQuad* node)
+	void visit(SphereLines* node)
 	{
-		glBindVertexArray(node->vao);
-		glUseProgram(node->program);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL
-			);
-
-		glUniformMatrix4fv(node->uP, 1, GL_TRUE, scene->P);
-		glUniformMatrix4fv(node->uMV, 1, GL_TRUE, scene->MV);
-	
-		glVertexAttribDivisor(0, 0); // particles vertices : always reuse the same 4 vertices -> 0
-		glVertexAttribDivisor(1, 1); // positions : one per quad (its center) -> 1
-		glVertexAttribDivisor(2, 1); // color : one per quad -> 1
-
-		// Draw the particules !
-		// This draws many times a small triangle_strip (which looks like a quad).
-		// This is equivalent to :
-		// for(i in ParticlesCount) : glDrawArrays(GL_TRIANGLE_STRIP, 0, 4), 
-		// but faster.
-		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, 10000);
-		
-		//glDrawArrays(GL_TRIANGLE_STRIP, 0, node->numVertices);
+		DrawItem item(node, *modelView, GL_FILL);
+		item.blend = true;
+
+		if (node->gpuParticles)
+		{
+			node->simulate();
+		}
+		else
+		{
+			int start = 0;
+			for (int i = 0; i < SphereLines::SpawnsPerFrame; ++i)
+			{
+				node->update(&start);
+			}
+			node->stream();
+			item.stream = node->colorStream;
+		}
+
+		queue.add(item.arrays(GL_TRIANGLE_STRIP, 0, node->numVertices));
 	}
-	virtual void visit(Cube* node)
+    void visit( InstancedGeometry* node ) {
+        if ( node->dynamic ) { node->upload(); }
+        if ( node->instances.empty() ) { return; }
+
+        // queue the mesh's draws, then redirect them through the node's
+        //   program and vertex array, each drawing every instance
+        size_t first = queue.items.size();
+        visitNode( node->mesh );
+        for ( size_t i = first; i < queue.items.size(); ++i ) {
+            DrawItem& item = queue.items[i];
+            item.program = node->program;
+            item.vao = node->vao;
+            item.instances = GLsizei( node->instances.size() );
+            item.stream = node->instanceStream;
+        }
+    }
+	void visit(Cube* node)
 	{
-		glBindVertexArray(node->vao);
-		glUseProgram(node->program);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL
-			);
-
-		glUniformMatrix4fv(node->uP, 1, GL_TRUE, scene->P);
-		glUniformMatrix4fv(node->uMV, 1, GL_TRUE, scene->MV);
-
-		glDrawArrays(GL_TRIANGLES, 0, node->numVertices);
-		
+		DrawItem item(node, *modelView, GL_FILL);
+		queue.add(item.arrays(GL_TRIANGLES, 0, node->numVertices));
 	}
-	virtual void visit(Sphere* node)
+	void visit(Sphere* node)
 	{
-		glBindVertexArray(node->vao);
-		glUseProgram(node->program);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-		glUniformMatrix4fv(node->uP, 1, GL_TRUE, scene->P);
-		glUniformMatrix4fv(node->uMV, 1, GL_TRUE, scene->MV);
-		
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, node->numVertices);
-		
+		DrawItem item(node, *modelView, GL_FILL);
+		queue.add(item.elements(GL_TRIANGLES, node->numIndices, 0,
+			node->indexType));
 	}
-    virtual void visit( Transform* transform ) {
-        mat4 tmp = scene->MV;
-        scene->MV *= transform->xform;
-        for ( auto n : transform->nodes ) {
-            n->receive( this );
+    void visit( Mesh* node ) {
+        for ( auto& d : node->draws ) {
+            DrawItem item( node, *modelView, d.polygonMode );
+            item.blend = d.blend != 0;
+            item.instances = d.instances;
+            if ( d.indexType ) {
+                item.elements( d.mode, d.count, d.offset );
+                item.indexType = d.indexType;
+            }
+            else {
+                item.arrays( d.mode, d.first, d.count );
+            }
+            queue.add( item );
+        }
+    }
+    void visit( LOD* node ) {
+        int level = node->select( _projectedSize( node ) );
+        if ( level < 0 ) { return; }
+
+        ++queue.stats.lodDraws[level];
+        _visit( node->levels[level] );
+    }
+    void visit( Transform* transform ) {
+        const mat4*         parentMV = modelView;
+        unsigned long       parentVersion = mvVersion;
+        const ViewFrustum*  parentFrustum = frustum;
+
+        if ( transform->updateWorld( *modelView, mvVersion, scene->P ) ) {
+            ++queue.stats.transformsUpdated;
+        }
+        if ( occlusion && !compiling &&
+             !occlusion->visible( transform, occlusionTests ) ) {
+            ++queue.stats.nodesOccluded;
+            return;
+        }
+        modelView = &transform->world;
+        mvVersion = transform->worldVersion;
+        frustum = &transform->frustum;
+
+        int parentIndex = transformIndex;
+        if ( compiling ) {
+            transformIndex = compiling->addTransform( transform, parentIndex );
+        }
+
+        _visitNodes( transform->nodes );
+        if ( compiling ) { compiling->closeTransform( transformIndex ); }
+
+        transformIndex = parentIndex;
+        modelView = parentMV;
+        mvVersion = parentVersion;
+        frustum = parentFrustum;
+    }
+
+  private:
+    RenderList*  compiling;       // list being built by compile(), or NULL
+    int          transformIndex;  // index in compiling of the current
+                                  //   transform
+    bool         worker;          // running on a gather thread
+    size_t       maxThreads;      // threads, or the number of cores
+
+    // dynamic nodes met by a worker, with their model-view matrices
+    std::vector< std::pair<Node*, mat4> >  deferred;
+
+    // transforms to test for occlusion once the frame is drawn
+    std::vector<OcclusionCuller::Test>     occlusionTests;
+
+    void _begin( SceneGraph* s ) {
+        scene = s;
+        queue.clear();
+        maxThreads = threads ? threads : std::thread::hardware_concurrency();
+
+        modelView = &s->MV;
+        mvVersion = s->version();
+        if ( cull ) { sceneFrustum = ViewFrustum( s->P * s->MV ); }
+        frustum = &sceneFrustum;
+    }
+
+    // Record a compiled node's draws (or the node itself, if it is
+    //   dynamic or picks what to draw each frame) in the list being built
+    void _compile( Node* n ) {
+        GeometricObject* g = n->isGeometric() ?
+            static_cast<GeometricObject*>( n ) : NULL;
+        if ( (g && g->dynamic) || n->type == NodeType::LOD ) {
+            compiling->addDynamic( n, transformIndex );
+            return;
+        }
+
+        size_t first = queue.items.size();
+        visitNode( n );
+
+        BBox b;
+        if ( g && g->bounds( b ) ) {
+            for ( size_t i = first; i < queue.items.size(); ++i ) {
+                compiling->addDraw( queue.items[i], transformIndex, b );
+            }
+        }
+    }
+
+    // Size in pixels of n's bounds, projected at the current model-view
+    //   matrix, across the viewport's height
+    GLfloat _projectedSize( Node* n ) {
+        BBox b;
+        if ( !n->bounds( b ) ) { return 0.0; }
+
+        const mat4& MV = *modelView;
+        const mat4& P = scene->P;
+        Angel::vec4 c = MV * Angel::vec4( b.center(), 1.0 );
+
+        GLfloat scale = 0.0;
+        for ( int j = 0; j < 3; ++j ) {
+            scale = std::max( scale, GLfloat( std::sqrt( MV[0][j] * MV[0][j] +
+                MV[1][j] * MV[1][j] + MV[2][j] * MV[2][j] ) ) );
+        }
+        GLfloat radius = 0.5 * b.diameter() * scale;
+
+        GLfloat w = Angel::dot( P[3], c );
+        if ( w <= radius ) { return viewportHeight; }  // camera inside it
+        return radius * P[1][1] * viewportHeight / w;
+    }
+
+    void _visit( Node* n ) {
+        if ( compiling ) {
+            _compile( n );
+            return;
+        }
+
+        BBox b;
+        if ( cull && n->bounds( b ) && !frustum->intersects( b ) ) {
+            ++queue.stats.nodesCulled;
+            return;
+        }
+        ++queue.stats.nodesVisible;
+
+        if ( worker && n->isGeometric() &&
+             static_cast<GeometricObject*>( n )->dynamic ) {
+            deferred.push_back( std::make_pair( n, *modelView ) );
+            return;
+        }
+        visitNode( n );
+    }
+
+    void _visitNodes( const std::vector<Node*>& nodes ) {
+        size_t n = std::min( maxThreads,
+                             nodes.size() / std::max<size_t>( grain, 1 ) );
+
+        if ( worker || compiling || n < 2 ) {
+            for ( auto node : nodes ) {
+                _visit( node );
+            }
+            return;
+        }
+
+        std::vector<RenderTraversal>  workers( n );
+        std::vector<std::thread>      pool;
+        for ( size_t i = 0; i < n; ++i ) {
+            RenderTraversal* w = &workers[i];
+            w->scene = scene;
+            w->cull = cull;
+            w->modelView = modelView;
+            w->mvVersion = mvVersion;
+            w->frustum = frustum;
+            w->viewportHeight = viewportHeight;
+            w->occlusion = occlusion;
+            w->worker = true;
+
+            size_t first = nodes.size() * i / n;
+            size_t last = nodes.size() * (i + 1) / n;
+            pool.push_back( std::thread( [w, &nodes, first, last]() {
+                for ( size_t j = first; j < last; ++j ) {
+                    w->_visit( nodes[j] );
+                }
+            } ) );
+        }
+
+        for ( size_t i = 0; i < n; ++i ) {
+            pool[i].join();
+            queue.append( workers[i].queue );
+            occlusionTests.insert( occlusionTests.end(),
+                workers[i].occlusionTests.begin(),
+                workers[i].occlusionTests.end() );
+        }
+
+        // now back on the GL thread
+        const mat4* parentMV = modelView;
+        for ( auto& w : workers ) {
+            for ( auto& d : w.deferred ) {
+                modelView = &d.second;
+                visitNode( d.first );
+            }
         }
-        scene->MV = tmp;
+        modelView = parentMV;
     }
 };
 
@@ -0,0 +1,136 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- UniformBlocks.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __UNIFORMBLOCKS_H__
+#define __UNIFORMBLOCKS_H__
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "Angel.h"
+#include "StreamBuffer.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- UniformBlocks ---
+//
+/// \class UniformBlocks
+/// \brief The uniform buffers behind every program's Frame and Object
+///    blocks
+/// \details The shaders declare
+///
+///      layout(std140, row_major) uniform Frame  { mat4 P; };
+///      layout(std140, row_major) uniform Object { mat4 MV; };
+///
+///    and InitShader() binds the blocks to Angel::FrameBlockBinding and
+///    Angel::ObjectBlockBinding, so one buffer range serves every program.
+///    row_major lets an Angel::mat4 be copied as it is, with no transpose.
+///
+///    setFrame() writes P once per frame.  Each frame's model-view
+///    matrices are appended to objects, written together by one
+///    uploadObjects() a frame (more would wrap the StreamBuffer's
+///    regions early), and selected per draw by bindObject(), which only
+///    rebinds the Object block's range.  Both buffers are StreamBuffers, so
+///    a write never stalls on draws still reading an earlier frame's
+///    matrices; call fence() once those draws are issued.
+///
+///    One set is shared by every queue (shared()), created on first use,
+///    and must be used on the GL thread.
+
+struct UniformBlocks {
+
+    typedef Angel::mat4  mat4;
+
+    std::vector<mat4>  objects;  /// model-view matrices for uploadObjects()
+
+    UniformBlocks( size_t capacity = 1024 ) : frameStream(NULL),
+        objectStream(NULL), objectBase(0), objectsWritten(0) {
+
+        GLint alignment = 256;
+        glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+        stride = (GLsizeiptr( sizeof(mat4) ) + alignment - 1) /
+                 alignment * alignment;
+
+        frameStream = new StreamBuffer( GL_UNIFORM_BUFFER, stride );
+        objectStream = new StreamBuffer( GL_UNIFORM_BUFFER,
+                                         GLsizeiptr( capacity ) * stride );
+    }
+
+    ~UniformBlocks() {
+        delete frameStream;
+        delete objectStream;
+    }
+
+    UniformBlocks( const UniformBlocks& ) = delete;
+    UniformBlocks& operator = ( const UniformBlocks& ) = delete;
+
+    /// The blocks every RenderQueue submits through
+    static UniformBlocks& shared() {
+        static UniformBlocks*  blocks = new UniformBlocks();
+        return *blocks;
+    }
+
+    /// Write P to the Frame block and bind it
+    void setFrame( const mat4& P ) {
+        GLintptr offset = frameStream->write( (const GLfloat*) P,
+                                              sizeof(mat4) );
+        glBindBufferRange( GL_UNIFORM_BUFFER, Angel::FrameBlockBinding,
+                           frameStream->buffer, offset, sizeof(mat4) );
+    }
+
+    /// Write every matrix in objects, each at the start of an aligned
+    ///   Object block, with one buffer update, then clear objects.  The
+    ///   buffer grows when objects outnumber its blocks.
+    void uploadObjects() {
+        if ( objects.empty() ) { return; }
+
+        GLsizeiptr size = GLsizeiptr( objects.size() ) * stride;
+        if ( size > objectStream->regionSize ) {
+            GLsizeiptr regionSize = std::max( size,
+                                              2 * objectStream->regionSize );
+            delete objectStream;
+            objectStream = new StreamBuffer( GL_UNIFORM_BUFFER, regionSize );
+        }
+
+        staging.resize( size_t( size ) );
+        for ( size_t i = 0; i < objects.size(); ++i ) {
+            memcpy( &staging[i * stride], (const GLfloat*) objects[i],
+                    sizeof(mat4) );
+        }
+        objectBase = objectStream->write( &staging[0], size );
+        objectsWritten = objects.size();
+        objects.clear();
+    }
+
+    /// Point the Object block at matrix i of the last uploadObjects()
+    void bindObject( size_t i ) {
+        glBindBufferRange( GL_UNIFORM_BUFFER, Angel::ObjectBlockBinding,
+                           objectStream->buffer, objectBase + i * stride,
+                           sizeof(mat4) );
+    }
+
+    /// Mark the last writes as in use by the draws issued so far
+    void fence() {
+        frameStream->fence();
+        if ( objectsWritten ) { objectStream->fence(); }
+    }
+
+  private:
+    StreamBuffer*         frameStream;
+    StreamBuffer*         objectStream;
+    GLsizeiptr            stride;          // bytes between Object blocks
+    GLintptr              objectBase;      // offset of the last upload
+    size_t                objectsWritten;  // matrices in the last upload
+    std::vector<GLubyte>  staging;
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __UNIFORMBLOCKS_H__
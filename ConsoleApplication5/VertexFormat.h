@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- VertexFormat.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __VERTEXFORMAT_H__
+#define __VERTEXFORMAT_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "Angel.h"
+
+namespace Scene {
+
+//----------------------------------------------------------------------------
+//
+//  --- VertexFormat ---
+//
+/// \class VertexFormat
+/// \brief The switch between full float vertices and the compact layout
+/// \details In the compact layout a shape stores positions and texture
+///    coordinates as half floats and colors as normalized unsigned bytes,
+///    using the attribute types below, so the vertex shaders see the same
+///    values (to within rounding) in half or less of the memory.  Shapes
+///    read compact() once, when constructed, and cache their meshes under
+///    a key naming the layout, so both kinds can coexist.  Off by default.
+
+struct VertexFormat {
+    static bool& compact() {
+        static bool  on = false;
+        return on;
+    }
+};
+
+/// Round f to the nearest IEEE 754 half float (binary16), ties to even
+inline GLushort toHalf( GLfloat f )
+{
+    uint32_t x;
+    memcpy( &x, &f, sizeof(x) );
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mantissa = x & 0x7fffff;
+    int      exponent = int( (x >> 23) & 0xff ) - 127 + 15;
+
+    if ( (x & 0x7fffffff) >= 0x7f800000 ) {  // infinity or NaN
+        return GLushort( sign | 0x7c00 | (mantissa ? 0x200 : 0) );
+    }
+    if ( exponent >= 31 ) { return GLushort( sign | 0x7c00 ); }
+
+    int shift = 13;
+    if ( exponent <= 0 ) {  // subnormal, or too small for one
+        if ( exponent < -10 ) { return GLushort( sign ); }
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        exponent = 0;
+    }
+
+    // a carry out of the mantissa correctly bumps the exponent
+    uint32_t h = (uint32_t( exponent ) << 10) | (mantissa >> shift);
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if ( rest > halfway || (rest == halfway && (h & 1)) ) { ++h; }
+    return GLushort( sign | h );
+}
+
+/// Round v, clamped to [0, 1], to a GL_UNSIGNED_BYTE normalized value
+inline GLubyte toUnorm8( GLfloat v )
+    { return GLubyte( std::min( std::max( v, 0.0f ), 1.0f ) * 255.0 + 0.5 ); }
+
+/// Position as three GL_HALF_FLOAT components, padded with a fourth to
+///   8 bytes so every vertex stays 4-byte aligned
+struct HalfPosition {
+    GLushort  xyz[3];
+    GLushort  pad;
+
+    HalfPosition() {}
+    HalfPosition( const Angel::vec3& v ) : pad(0)
+        { for ( int i = 0; i < 3; ++i ) { xyz[i] = toHalf( v[i] ); } }
+};
+
+/// Texture coordinates (or any vec2) as two GL_HALF_FLOAT components
+struct HalfVec2 {
+    GLushort  xy[2];
+
+    HalfVec2() {}
+    HalfVec2( const Angel::vec2& v )
+        { xy[0] = toHalf( v.x ); xy[1] = toHalf( v.y ); }
+};
+
+/// RGBA color as four normalized GL_UNSIGNED_BYTE components
+struct Color8 {
+    GLubyte  rgba[4];
+
+    Color8() {}
+    Color8( const Angel::vec4& c )
+        { for ( int i = 0; i < 4; ++i ) { rgba[i] = toUnorm8( c[i] ); } }
+};
+
+//----------------------------------------------------------------------------
+
+};  // namespace Scene
+
+#endif // __VERTEXFORMAT_H__
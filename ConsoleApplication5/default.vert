@@ -1,8 +1,8 @@
 #version 410
 
 
-uniform mat4 P;
-uniform mat4 MV;
+layout(std140, row_major) uniform Frame { mat4 P; };
+layout(std140, row_major) uniform Object { mat4 MV; };
 out vec2 fTexCoord;
 out vec3 fragmentColor;
 layout(location = 0) in vec4 vPosition;
@@ -1,7 +1,12 @@
 
 #include <cmath>
 #include <cstddef>
+#include <cctype>
 #include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <typeinfo>
 #include <vector>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
@@ -13,6 +18,14 @@ using std::sin;
 
 #include "Angel.h"
 #include "Scene.h"
+#include "Benchmark.h"
+#include "FramePacer.h"
+
+#ifdef _WIN32
+#  include <GL/wglew.h>
+#elif !defined(__APPLE__)
+#  include <GL/glx.h>
+#endif
 
 using namespace std;
 using namespace Angel;
@@ -20,11 +33,51 @@ using namespace Scene;
 
 SceneGraph*  scene;
 Transform*   xform;
+RenderList   renderList;  // flattened scene, used when flatRender is set
+BVH          bvh;         // the scene's shapes, for picking with the mouse
+OcclusionCuller*  occlusion = NULL;  // set by -occlusion once GL is up
+StaticBatches*    batches = NULL;    // set by -batch once GL is up
 
 GLfloat  fovy = 80.0;
 GLfloat zNear = 1.0;
 GLfloat zFar;
 vec3    center;
+
+//  Headless benchmark settings, set from the command line in parseArgs()
+bool         headless = false;     // render offscreen and exit
+int          benchFrames = 300;    // number of frames rendered headless
+int          benchWidth = 512;     // offscreen framebuffer size
+int          benchHeight = 512;
+std::string  sceneName = "default";  // "default", "cones", "instanced" or
+                                     //   "spheres"
+int          sceneCount = 100;     // number of shapes in generated scenes
+bool         gpuParticles = true;  // simulate SphereLines with transform feedback
+bool         shaderCache = true;   // keep program binaries next to the exe
+bool         frustumCull = true;   // skip nodes outside the view volume
+bool         occlusionCull = false;  // skip subtrees hidden last frame
+bool         flatRender = false;   // gather draws from renderList
+bool         staticBatching = false;  // merge renderList's static draws
+bool         benchGather = false;  // time the two gather paths and exit
+bool         benchMath = false;    // time the mat4 kernels and exit
+bool         benchNodes = false;   // time node creation and teardown, exit
+bool         benchInstancing = false;  // time cones as nodes and instanced
+bool         benchMesh = false;    // report sphere tessellation stats, exit
+bool         benchBvh = false;     // time BVH builds and queries, then exit
+bool         benchVisit = false;   // time virtual and static node visits
+unsigned     gatherThreads = 0;    // threads walking the scene, 0 = per core
+std::string  loadFile;             // scene file to load instead of building
+std::string  saveFile;             // scene file to write after init()
+bool         useLod = false;       // build shapes as LOD nodes
+int          lodLevels = 0;        // levels per LOD node in the scene
+GLfloat      viewportHeight = 512; // pixels, set by reshape()
+
+//  Interactive loop settings, also set in parseArgs()
+FramePacer   pacer;                // sleeps idle() to -fps and reports
+int          swapInterval = -1;    // -vsync: retraces per swap, -1 leaves
+                                   //   the driver's setting
+bool         animating = true;     // idle() turns xform; space toggles
+const GLfloat  RotationRate = 30.0;  // degrees a second xform turns
+
 Angel::mat4 polarview(GLfloat dist, GLfloat elev,GLfloat azim, GLfloat twist)
 {
 	Angel::mat4 m ;
@@ -49,10 +102,116 @@ void special(int key, int x, int y)
 	}
 	glutPostRedisplay();
 }
+void idle(void);
+
+// Space pauses and resumes the animation; any other key quits, printing
+//   the frame-time report
 void keyboard(unsigned char key, int x, int y)
 {
+	if (key == ' ')
+	{
+		animating = !animating;
+		if (animating && pacer.onDemand)
+		{
+			pacer.restart();
+			glutIdleFunc(idle);
+		}
+		return;
+	}
+
+	pacer.report(std::cout);
+	delete occlusion;
+	delete batches;
+	delete scene;  // frees the nodes' GL objects while the context is alive
 	exit(EXIT_SUCCESS);
 }
+// Print the shape under the cursor when the left button is pressed.
+//   reshape() makes MV a translation by center, so the ray starts at
+//   -center in the frame of the scene's top-level nodes and keeps its
+//   eye-space direction.
+void mouse(int button, int state, int x, int y)
+{
+	if (button != GLUT_LEFT_BUTTON || state != GLUT_DOWN)
+		return;
+
+	if (bvh.stale())
+		bvh.build(scene);
+	else
+		bvh.refit();  // idle() turns xform every frame
+
+	GLfloat width = glutGet(GLUT_WINDOW_WIDTH);
+	GLfloat height = glutGet(GLUT_WINDOW_HEIGHT);
+	GLfloat tangent = std::tan(0.5 * fovy * DegreesToRadians);
+	vec3 dir(tangent * width / height * (2.0 * (x + 0.5) / width - 1.0),
+		tangent * (1.0 - 2.0 * (y + 0.5) / height), -1.0);
+
+	GLfloat distance;
+	if (Node* n = bvh.pick(-center, normalize(dir), &distance))
+		std::cout << "picked " << typeid(*n).name() << " at distance "
+			<< distance << std::endl;
+	else
+		std::cout << "picked nothing" << std::endl;
+}
+
+// Add a square grid of sceneCount identical spheres, sharing one mesh, to
+//   parent, each under its own transform
+void addSpheres(SceneGraph* s, Transform* parent)
+{
+	int side = int(std::ceil(std::sqrt(double(sceneCount))));
+	for (int i = 0; i < sceneCount; ++i)
+	{
+		Transform* t = s->create<Transform>();
+		t->xform = Translate(7.0 * (i % side), 7.0 * (i / side), 0.0);
+		t->addNode(s->create<Sphere>(3));
+		parent->addNode(t);
+	}
+}
+
+// Add a square grid of sceneCount cones to parent.  Each cone is under its
+//   own transform, and with useLod is an LOD node sharing the same three
+//   cones; if instanced the grid is instead one InstancedGeometry node.
+void addCones(SceneGraph* s, Transform* parent, bool instanced)
+{
+	int side = int(std::ceil(std::sqrt(double(sceneCount))));
+	if (instanced)
+	{
+		std::vector<InstancedGeometry::Instance> instances;
+		for (int i = 0; i < sceneCount; ++i)
+			instances.push_back(InstancedGeometry::Instance(
+				Translate(2.5 * (i % side), 2.5 * (i / side), 0.0),
+				vec4(GLfloat(i % side) / side, GLfloat(i / side) / side,
+					1.0, 1.0)));
+		parent->addNode(s->create<InstancedGeometry>(s->create<Cone>(10),
+			instances));
+		return;
+	}
+
+	Cone* levels[] = { NULL, NULL, NULL };
+	if (useLod)
+	{
+		levels[0] = s->create<Cone>(32);
+		levels[1] = s->create<Cone>(10);
+		levels[2] = s->create<Cone>(4);
+		lodLevels = 3;
+	}
+	for (int i = 0; i < sceneCount; ++i)
+	{
+		Transform* t = s->create<Transform>();
+		t->xform = Translate(2.5 * (i % side), 2.5 * (i / side), 0.0);
+		if (useLod)
+		{
+			LOD* lod = s->create<LOD>();
+			lod->addLevel(levels[0], 48.0);
+			lod->addLevel(levels[1], 12.0);
+			lod->addLevel(levels[2], 0.0);
+			t->addNode(lod);
+		}
+		else
+			t->addNode(s->create<Cone>(10));
+		parent->addNode(t);
+	}
+}
+
 void init()
 {
     glClearColor(0.0, 0.0, 0.0, 1.0);
@@ -61,20 +220,81 @@ void init()
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     scene = new SceneGraph();
 	
-    xform = new Transform();
+    xform = scene->create<Transform>();
     scene->addNode( xform );
 	//xform->addNode(new GroundPlane());
 	//xform->addNode(new Cube());
 	
-	xform->addNode(new Sphere(3));
-	xform->addNode(new SphereLines(15));
-	//xform->addNode(new LineQuad());
-	
+	if (!loadFile.empty())
+	{
+		SceneFile file;
+		if (!file.open(loadFile.c_str()))
+		{
+			std::cerr << "Can't load scene file " << loadFile << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		file.load(scene, xform);
+		sceneName = loadFile;
+	}
+	else if (sceneName == "cones")
+		addCones(scene, xform, false);
+	else if (sceneName == "instanced")
+		addCones(scene, xform, true);
+	else if (sceneName == "spheres")
+		addSpheres(scene, xform);
+	else if (sceneName == "wall")
+	{
+		// the spheres, with a wall between the camera and the left half
+		addSpheres(scene, xform);
+		int side = int(std::ceil(std::sqrt(double(sceneCount))));
+		GLfloat halfWidth = 0.5 * (3.5 * (side - 1) + 4.0);
+		GLfloat halfHeight = 3.5 * (side - 1) + 4.0;
+		Transform* wall = scene->create<Transform>();
+		wall->xform = Translate(halfWidth - 4.0, 3.5 * (side - 1), 8.0) *
+			Scale(halfWidth, halfHeight, 1.0);
+		wall->addNode(scene->create<Cube>());
+		xform->addNode(wall);
+	}
+	else
+	{
+		if (useLod)
+		{
+			LOD* lod = scene->create<LOD>();
+			lod->addLevel(scene->create<Sphere>(3), 160.0);
+			lod->addLevel(scene->create<Sphere>(3, "default.vert",
+				"default.frag", 12), 48.0);
+			lod->addLevel(scene->create<Sphere>(3, "default.vert",
+				"default.frag", 30), 0.0);
+			xform->addNode(lod);
+			lodLevels = 3;
+		}
+		else
+			xform->addNode(scene->create<Sphere>(3));
+		xform->addNode(scene->create<SphereLines>(15, "Line.vert", "Line.frag",
+			gpuParticles));
+	}
 	//xform->addNode(new Sphere(3));
 	//xform->addNode( new Cone(100) );
 	
+	if (!saveFile.empty())
+	{
+		Stopwatch save;
+		SceneWriter writer;
+		writer.traverse(scene);
+		if (!writer.write(saveFile.c_str()))
+			std::cerr << "Can't write scene file " << saveFile << std::endl;
+		else
+			std::cout << "saved " << saveFile << ": " << writer.nodes.size()
+				<< " nodes, " << writer.meshes.size() << " meshes, "
+				<< writer.blobs.size() / 1024 << " KB of blobs ("
+				<< writer.skipped << " skipped) in " << save.elapsed()
+				<< " ms" << std::endl;
+	}
+
+    Stopwatch bounds;
     BoundingBoxTraversal bbox;
     bbox.traverse( scene );
+    std::cout << "bounds: " << bounds.elapsed() << " ms" << std::endl;
 
     center = -bbox.bbox.center();
     center.z -= 0.5 * bbox.bbox.diameter();
@@ -82,24 +302,46 @@ void init()
 }
 
 
-void display()
+void clearFrame()
 {
-	
 	glClear( GL_COLOR_BUFFER_BIT );
 	glEnable(GL_DEPTH_TEST);
 	// Accept fragment if it closer to the camera than the former one
 	glDepthFunc(GL_LESS);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+// Gather and submit the scene's draws, through renderList if flatRender
+void renderScene( RenderTraversal& render )
+{
+	render.cull = frustumCull;
+	render.threads = gatherThreads;
+	render.viewportHeight = viewportHeight;
+	render.occlusion = occlusion;
+	render.batches = batches;
+	if (flatRender)
+		render.gatherFlat(scene, renderList);
+	else
+		render.gather(scene);
+	render.submit();
+}
+
+void display()
+{
+	pacer.beginFrame();
+	clearFrame();
     RenderTraversal render;
-    render.traverse( scene );
+    renderScene( render );
     
     glutSwapBuffers();
+	pacer.endFrame();
 }
 
 void reshape( int width, int height )
 {
 	
 	glViewport( 0, 0, width, height );
+	viewportHeight = height;
 
     GLfloat aspect = GLfloat(width)/height;
     
@@ -111,11 +353,12 @@ void reshape( int width, int height )
 
 
 
-void idle( void )
+// Turn xform by step degrees, about an axis that changes every quarter
+//   turn
+void animate( GLfloat step )
 {
 	
 	static GLfloat angle = 0.0;
-	GLfloat angle2 = 0.5;
 	bool rotatevert;
 	bool rotatehorz;
 	if (std::abs(angle) < 90)
@@ -143,25 +386,908 @@ void idle( void )
 	
 	if (rotatevert == false && rotatehorz == false)
 	{
-		angle -= 0.5;
+		angle -= step;
 		
-		change *= Rotate(angle2, vec3(0, 1, 0));
+		change *= Rotate(step, vec3(0, 1, 0));
 	}
 	else if (rotatevert == true && rotatehorz == false)
 	{
-		angle -= 0.5;
-		change *= Rotate(angle2, vec3(1, 0, 0));
+		angle -= step;
+		change *= Rotate(step, vec3(1, 0, 0));
 	}
 	else if (rotatevert == true && rotatehorz == true)
 	{
-		angle -= 0.5;
-		change *= Rotate(angle2, vec3(0, 1, 1));
+		angle -= step;
+		change *= Rotate(step, vec3(0, 1, 1));
 	}
 	xform->xform *= change;
-	
-    glutPostRedisplay();
+	xform->changed();
+}
+
+// Wait for the next frame that pacer lets through, and draw it if the
+//   scene is moving or (without -ondemand) regardless.  Once an on-demand
+//   scene stops moving the idle callback is dropped, so GLUT sleeps until
+//   an event asks for a redraw.
+void idle( void )
+{
+	GLfloat seconds = pacer.wait();
+	if (animating)
+		animate(RotationRate * seconds);
+	else if (pacer.onDemand)
+	{
+		glutIdleFunc(NULL);
+		return;
+	}
+	glutPostRedisplay();
+}
+
+// Ask the window system to swap buffers only every interval vertical
+//   retraces (0 swaps at once), returning false if it can't
+bool setSwapInterval(int interval)
+{
+#ifdef _WIN32
+	if (WGLEW_EXT_swap_control)
+		return wglSwapIntervalEXT(interval) != FALSE;
+#elif !defined(__APPLE__)
+	typedef int (*SwapIntervalMESA)(unsigned int);
+	typedef int (*SwapIntervalSGI)(int);
+	if (SwapIntervalMESA swap = (SwapIntervalMESA) glXGetProcAddressARB(
+			(const GLubyte*) "glXSwapIntervalMESA"))
+		return swap(interval) == 0;
+	if (interval > 0)  // the SGI extension can't turn syncing off
+		if (SwapIntervalSGI swap = (SwapIntervalSGI) glXGetProcAddressARB(
+				(const GLubyte*) "glXSwapIntervalSGI"))
+			return swap(interval) == 0;
+#endif
+	return false;
+}
+
+
+// Parse the options glutInit() leaves behind:
+//   -headless          render offscreen, print frame timings and exit.
+//                      The context still comes from a (hidden) GLUT
+//                      window, so this and the -bench options need a
+//                      display: on a Linux machine without one, run
+//                      under Xvfb, e.g. xvfb-run -a ConsoleApplication5
+//                      -headless
+//   -frames N          number of frames to render headless
+//   -size W H          offscreen framebuffer size
+//   -scene NAME [N]    "default", "cones" with N cones, "instanced"
+//                      with N cones drawn as one InstancedGeometry, or
+//                      "spheres" with N spheres, or "wall", the spheres
+//                      with a wall in front of half of them
+//   -cpuparticles      update SphereLines on the CPU instead of the GPU
+//   -noshadercache     always compile shaders from source
+//   -nomeshcache       generate every shape's mesh, even if an identical
+//                      one exists
+//   -compactvertices   build shapes with half float positions and texture
+//                      coordinates and RGBA8 colors (see VertexFormat.h)
+//   -occlusion         skip transforms whose contents occlusion queries
+//                      found hidden (see OcclusionCuller.h)
+//   -nocull            draw every node, even outside the view frustum
+//   -flat              render from a RenderList instead of the scene graph
+//   -batch             render from a RenderList (as -flat), drawing its
+//                      static shapes in batches with multi-draw calls (see
+//                      StaticBatches.h)
+//   -benchgather       time gathering draws by traversal and from a
+//                      RenderList (no GL submit), and with -lod compare
+//                      the LOD levels picked on one thread and -threads,
+//                      then exit
+//   -benchmath         time the mat4 kernels against scalar loops, then exit
+//   -benchnodes        time creating, walking and destroying sceneCount
+//                      Transforms from the heap and from a NodePool, then exit
+//   -threads N         gather draws on at most N threads (0, the default,
+//                      uses one per core)
+//   -load FILE         load the scene from a binary scene file
+//   -save FILE         write the scene to a binary scene file after building
+//   -benchbvh          time building, refitting and querying a BVH over the
+//                      scene's shapes (with -threads), then exit
+//   -benchvisit        time a million node visits through virtual calls and
+//                      through StaticTraversal, then exit
+//   -benchmesh         report vertex and index counts and vertex cache
+//                      misses of indexed sphere tessellations, then exit
+//   -benchinstancing   time N cones as separate nodes and as one
+//                      InstancedGeometry (N from -scene), then exit
+//   -lod               build the scene's shapes as LOD nodes with several
+//                      tessellations, picked by their size on screen
+//   -fps N             draw at most N frames a second in the window,
+//                      sleeping between them (default 60, 0 for no limit;
+//                      see FramePacer.h); -headless is never paced
+//   -vsync 0|1         swap buffers at once (0) or on vertical retrace (1),
+//                      rather than as the driver chooses
+//   -ondemand          draw only when the scene changes: while the
+//                      animation is paused (space) nothing is drawn until
+//                      the window needs it
+//   -framereport S     print frame rate and frame-time consistency every
+//                      S seconds (it is always printed on quitting)
+void parseArgs( int argc, CHAR* argv[] )
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-headless"))
+			headless = true;
+		else if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+			benchFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-size") && i + 2 < argc)
+		{
+			benchWidth = atoi(argv[++i]);
+			benchHeight = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-scene") && i + 1 < argc)
+		{
+			sceneName = argv[++i];
+			if (i + 1 < argc && isdigit(argv[i + 1][0]))
+				sceneCount = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-cpuparticles"))
+			gpuParticles = false;
+		else if (!strcmp(argv[i], "-noshadercache"))
+			shaderCache = false;
+		else if (!strcmp(argv[i], "-nomeshcache"))
+			MeshCache::enabled() = false;
+		else if (!strcmp(argv[i], "-compactvertices"))
+			VertexFormat::compact() = true;
+		else if (!strcmp(argv[i], "-occlusion"))
+			occlusionCull = true;
+		else if (!strcmp(argv[i], "-nocull"))
+			frustumCull = false;
+		else if (!strcmp(argv[i], "-flat"))
+			flatRender = true;
+		else if (!strcmp(argv[i], "-batch"))
+			flatRender = staticBatching = true;
+		else if (!strcmp(argv[i], "-benchgather"))
+			benchGather = true;
+		else if (!strcmp(argv[i], "-benchmath"))
+			benchMath = true;
+		else if (!strcmp(argv[i], "-benchnodes"))
+			benchNodes = true;
+		else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+			gatherThreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-load") && i + 1 < argc)
+			loadFile = argv[++i];
+		else if (!strcmp(argv[i], "-save") && i + 1 < argc)
+			saveFile = argv[++i];
+		else if (!strcmp(argv[i], "-benchbvh"))
+			benchBvh = true;
+		else if (!strcmp(argv[i], "-benchvisit"))
+			benchVisit = true;
+		else if (!strcmp(argv[i], "-benchmesh"))
+			benchMesh = true;
+		else if (!strcmp(argv[i], "-benchinstancing"))
+			benchInstancing = true;
+		else if (!strcmp(argv[i], "-lod"))
+			useLod = true;
+		else if (!strcmp(argv[i], "-fps") && i + 1 < argc)
+			pacer.targetFps = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-vsync") && i + 1 < argc)
+			swapInterval = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-ondemand"))
+			pacer.onDemand = true;
+		else if (!strcmp(argv[i], "-framereport") && i + 1 < argc)
+			pacer.reportSeconds = atof(argv[++i]);
+		else
+			std::cerr << "Ignoring unknown option " << argv[i] << std::endl;
+	}
 }
 
+// Create a benchWidth x benchHeight framebuffer object with color and
+//   depth renderbuffers, and bind it in place of the window
+bool createOffscreen(GLuint& fbo, GLuint renderbuffers[2])
+{
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+	glGenRenderbuffers(2, renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, benchWidth, benchHeight);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_RENDERBUFFER, renderbuffers[0]);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+		benchWidth, benchHeight);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_RENDERBUFFER, renderbuffers[1]);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void deleteOffscreen(GLuint fbo, GLuint renderbuffers[2])
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteRenderbuffers(2, renderbuffers);
+	glDeleteFramebuffers(1, &fbo);
+}
+
+// Render benchFrames frames into a framebuffer object instead of the
+//   window, timing each one, then report the statistics.  The window is
+//   only needed for its GL context and stays hidden.
+int runHeadless()
+{
+	GLuint fbo, renderbuffers[2];
+	if (!createOffscreen(fbo, renderbuffers))
+		return EXIT_FAILURE;
+
+	reshape(benchWidth, benchHeight);
+
+	FrameTimings timings;
+	for (int i = 0; i < benchFrames; ++i)
+	{
+		animate(0.5);  // a 60 fps frame's turn, whatever the frame rate
+
+		StreamBuffer::bytesStreamed() = 0;
+		Stopwatch frame;
+		clearFrame();
+
+		Stopwatch traverse;
+		RenderTraversal render;
+		renderScene(render);
+		timings.traverse.add(traverse.elapsed());
+
+		Stopwatch submit;
+		glFinish();
+		timings.submit.add(submit.elapsed());
+
+		timings.frame.add(frame.elapsed());
+		timings.counter("streamed", "KB").add(
+			StreamBuffer::bytesStreamed() / 1024.0);
+		timings.counter("draw calls").add(render.stats().drawCalls);
+		timings.counter("state chgs").add(render.stats().stateChanges);
+		timings.counter("uniforms").add(render.stats().uniforms);
+		timings.counter("visible").add(render.stats().nodesVisible);
+		timings.counter("culled").add(render.stats().nodesCulled);
+		if (occlusion)
+		{
+			timings.counter("occluded").add(render.stats().nodesOccluded);
+			timings.counter("occl. tests").add(
+				render.stats().occlusionQueries);
+		}
+		if (batches)
+			timings.counter("batched").add(render.stats().batchedDraws);
+		timings.counter("xforms upd").add(render.stats().transformsUpdated);
+		for (int level = 0; level < lodLevels; ++level)
+			timings.counter("lod " + std::to_string(level)).add(
+				render.stats().lodDraws[level]);
+	}
+
+	int linked, shared;
+	ProgramCacheCounts(linked, shared);
+
+	const MeshCache::Counts& meshes = MeshCache::counts();
+
+	std::cout << "scene: " << sceneName << "  " << benchWidth << "x"
+		<< benchHeight << "  " << glGetString(GL_RENDERER) << std::endl
+		<< "programs: " << linked << " linked, " << shared << " shared"
+		<< std::endl
+		<< "meshes: " << meshes.generated << " generated, " << meshes.hits
+		<< " shared, " << meshes.bytes / 1024 << " KB ("
+		<< meshes.buffers / 1024 << " KB "
+		<< (VertexFormat::compact() ? "compact " : "")
+		<< "vertices and indices)" << std::endl;
+	if (batches)
+		std::cout << "batches: " << batches->batches.size() << " holding "
+			<< batches->records << " of " << renderList.size()
+			<< " draw records, " << batches->bytes / 1024 << " KB"
+			<< std::endl;
+	timings.report(std::cout);
+
+	size_t count = scene->nodeCount();
+	Stopwatch teardown;
+	delete occlusion;
+	delete batches;
+	delete scene;
+	std::cout << "teardown: " << count << " nodes in " << teardown.elapsed()
+		<< " ms" << std::endl;
+
+	deleteOffscreen(fbo, renderbuffers);
+	return EXIT_SUCCESS;
+}
+
+// Render the same grid of sceneCount cones for benchFrames frames each as
+//   Transform and Cone nodes (the scene init() built) and as one
+//   InstancedGeometry node, offscreen and from a static view, and compare
+//   the time to gather and submit, the time to finish the frame and the
+//   GL calls made.
+int runInstancingBenchmark()
+{
+	GLuint fbo, renderbuffers[2];
+	if (!createOffscreen(fbo, renderbuffers))
+		return EXIT_FAILURE;
+
+	reshape(benchWidth, benchHeight);
+
+	SceneGraph* instanced = new SceneGraph();
+	instanced->P = scene->P;
+	instanced->MV = scene->MV;
+	Transform* t = instanced->create<Transform>();
+	instanced->addNode(t);
+	addCones(instanced, t, true);
+
+	SceneGraph* graphs[] = { scene, instanced };
+	const char* names[] = { "nodes", "inst" };
+	std::cout << "instancing: " << sceneCount << " cones  " << benchWidth
+		<< "x" << benchHeight << "  " << glGetString(GL_RENDERER) << std::endl;
+
+	for (int g = 0; g < 2; ++g)
+	{
+		Samples cpu(std::string(names[g]) + " cpu"),
+			frame(std::string(names[g]) + " frame");
+		RenderStats stats;
+		for (int i = 0; i < benchFrames; ++i)
+		{
+			Stopwatch watch;
+			clearFrame();
+			RenderTraversal render;
+			render.cull = frustumCull;
+			render.threads = gatherThreads;
+			render.viewportHeight = viewportHeight;
+			render.gather(graphs[g]);
+			render.submit();
+			cpu.add(watch.elapsed());
+
+			glFinish();
+			frame.add(watch.elapsed());
+			stats = render.stats();
+		}
+		std::cout << names[g] << ": " << graphs[g]->nodeCount()
+			<< " nodes, " << stats.drawCalls << " draw calls, "
+			<< stats.uniforms << " uniforms" << std::endl
+			<< cpu << std::endl << frame << std::endl;
+	}
+
+	delete instanced;
+	delete scene;
+	deleteOffscreen(fbo, renderbuffers);
+	return EXIT_SUCCESS;
+}
+
+// Time only the CPU side of building a frame's draw list, walking the
+//   scene graph and walking a compiled RenderList, over benchFrames frames
+//   of a static view.  No draws are submitted, so the GL doesn't mask the
+//   difference.  With -lod, also check that one gather thread and
+//   gatherThreads pick the same LOD levels.
+int runGatherBenchmark()
+{
+	reshape(benchWidth, benchHeight);
+
+	RenderTraversal render;
+	render.cull = frustumCull;
+	render.threads = gatherThreads;
+	render.viewportHeight = viewportHeight;
+
+	Stopwatch compile;
+	render.compile(scene, renderList);
+	double compileTime = compile.elapsed();
+
+	Samples visitor("visitor"), flat("flat");
+	for (int i = 0; i < benchFrames; ++i)
+	{
+		Stopwatch gather;
+		render.gather(scene);
+		visitor.add(gather.elapsed());
+
+		gather.reset();
+		render.gatherFlat(scene, renderList);
+		flat.add(gather.elapsed());
+	}
+
+	std::cout << "scene: " << sceneName << "  " << sceneCount << " shapes, "
+		<< renderList.size() << " draw records, "
+		<< renderList.transforms.size() << " transforms" << std::endl
+		<< "compile: " << compileTime << " ms" << std::endl
+		<< "gather, frames: " << benchFrames << std::endl
+		<< visitor << std::endl
+		<< flat << std::endl;
+
+	// LOD levels must not depend on how many threads pick them
+	if (lodLevels)
+	{
+		RenderTraversal serial, threaded;
+		serial.cull = threaded.cull = frustumCull;
+		serial.viewportHeight = threaded.viewportHeight = viewportHeight;
+		serial.threads = 1;
+		threaded.threads = gatherThreads;
+		serial.gather(scene);
+		threaded.gather(scene);
+
+		bool same = true;
+		std::cout << "lod draws, 1 thread / threaded:";
+		for (int level = 0; level < lodLevels; ++level)
+		{
+			unsigned a = serial.stats().lodDraws[level];
+			unsigned b = threaded.stats().lodDraws[level];
+			std::cout << "  " << a << " / " << b;
+			same = same && a == b;
+		}
+		std::cout << (same ? "" : "  MISMATCH") << std::endl;
+		if (!same)
+		{
+			delete scene;
+			return EXIT_FAILURE;
+		}
+	}
+
+	delete scene;
+	return EXIT_SUCCESS;
+}
+
+// A random point in b
+vec3 randomPoint(const BBox& b)
+{
+	vec3 p;
+	for (int i = 0; i < 3; ++i)
+		p[i] = b.ll[i] + (b.ur[i] - b.ll[i]) * (rand() / GLfloat(RAND_MAX));
+	return p;
+}
+
+// Build a BVH over the scene's shapes on one thread and on gatherThreads,
+//   refit it after moving every tenth transform under xform, and time
+//   picks, ray, box and frustum queries against it, each of the last
+//   also checked against a linear scan of the objects' boxes.  Meant for
+//   large scenes, e.g. -scene cones 100000.
+int runBvhBenchmark()
+{
+	const int passes = 5, queries = 1000;
+	srand(1);
+
+	BVH bvh;
+	Samples serial("build 1 thr"), parallel("build"), refit("refit");
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		bvh.threads = 1;
+		Stopwatch watch;
+		bvh.build(scene);
+		serial.add(watch.elapsed());
+
+		bvh.threads = gatherThreads;
+		watch.reset();
+		bvh.build(scene);
+		parallel.add(watch.elapsed());
+
+		for (size_t i = pass; i < xform->nodes.size(); i += 10)
+			if (Transform* t = dynamic_cast<Transform*>(xform->nodes[i]))
+			{
+				t->xform = t->xform * Translate(0.0, 0.0, 0.5);
+				t->changed();
+			}
+		watch.reset();
+		bvh.refit();
+		refit.add(watch.elapsed());
+	}
+	if (bvh.size() == 0)
+	{
+		std::cerr << "The scene has no shapes" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// queries are scaled to the scene's bounds
+	BBox world = bvh.nodes[0].box;
+	vec3 extent = world.ur - world.ll;
+	BBox around(world.ll - 0.5 * extent, world.ur + 0.5 * extent);
+	GLfloat size = 0.02 * std::max(extent.x, std::max(extent.y, extent.z));
+
+	Samples pick("pick", "us"), ray("ray", "us"), box("box", "us"),
+		frustum("frustum", "us"), scan("scan frustum", "us");
+	size_t found = 0, mismatches = 0;
+	std::vector<Node*> hits;
+	for (int q = 0; q < queries; ++q)
+	{
+		// a ray from around the scene through a point in it
+		vec3 origin = randomPoint(around);
+		vec3 dir = normalize(randomPoint(world) - origin);
+		GLfloat distance = 0.0;
+		Stopwatch watch;
+		Node* picked = bvh.pick(origin, dir, &distance);
+		pick.add(1000.0 * watch.elapsed());
+
+		hits.clear();
+		watch.reset();
+		bvh.rayQuery(origin, dir, hits);
+		ray.add(1000.0 * watch.elapsed());
+		found += hits.size();
+
+		BVH::Ray r(origin, dir);
+		GLfloat nearest = std::numeric_limits<GLfloat>::infinity(), t;
+		size_t count = 0;
+		for (auto& b : bvh.boxes)
+			if (r.intersects(b, std::numeric_limits<GLfloat>::infinity(), t))
+			{
+				nearest = std::min(nearest, t);
+				++count;
+			}
+		if (count != hits.size() || (picked ? distance != nearest : count))
+			++mismatches;
+
+		// a box of 2% of the scene's size
+		vec3 c = randomPoint(world);
+		BBox query(c - vec3(size), c + vec3(size));
+		hits.clear();
+		watch.reset();
+		bvh.boxQuery(query, hits);
+		box.add(1000.0 * watch.elapsed());
+		found += hits.size();
+
+		count = 0;
+		for (auto& b : bvh.boxes)
+			count += BVH::overlaps(query, b);
+		mismatches += count != hits.size();
+
+		// a narrow view from around the scene toward a point in it
+		mat4 view = LookAt(vec4(origin, 1.0), vec4(c, 1.0),
+			vec4(0.0, 0.0, 1.0, 0.0));
+		ViewFrustum volume(Perspective(20.0, 1.0, 0.1,
+			4.0 * length(extent)) * view);
+		hits.clear();
+		watch.reset();
+		bvh.frustumQuery(volume, hits);
+		frustum.add(1000.0 * watch.elapsed());
+		found += hits.size();
+
+		count = 0;
+		watch.reset();
+		for (auto& b : bvh.boxes)
+			count += volume.intersects(b);
+		scan.add(1000.0 * watch.elapsed());
+		mismatches += count != hits.size();
+	}
+
+	std::cout << "bvh: " << bvh.size() << " objects, " << bvh.nodes.size()
+		<< " nodes, " << bvh.transforms.size() << " transforms" << std::endl
+		<< serial << std::endl << parallel << std::endl
+		<< refit << std::endl
+		<< "queries: " << queries << " of each, " << found << " hits, "
+		<< mismatches << " differing from a linear scan" << std::endl
+		<< pick << std::endl << ray << std::endl << box << std::endl
+		<< frustum << std::endl << scan << std::endl;
+
+	delete scene;
+	return EXIT_SUCCESS;
+}
+
+// Counts the nodes of a scene and sums their vertex counts, through
+//   Node::receive() and virtual visits
+struct VirtualVisitCounter : public Traversal
+{
+	size_t visits;
+	long   sum;
+
+	VirtualVisitCounter() : visits(0), sum(0) {}
+
+	void count(GeometricObject* node) { ++visits; sum += node->numVertices; }
+
+	virtual void visit(GeometricObject* node) { count(node); }
+	virtual void visit(Cone* node) { count(node); }
+	virtual void visit(GroundPlane* node) { count(node); }
+	virtual void visit(Cube* node) { count(node); }
+	virtual void visit(Sphere* node) { count(node); }
+	virtual void visit(SphereLines* node) { count(node); }
+	virtual void visit(InstancedGeometry* node) { count(node); }
+	virtual void visit(Mesh* node) { count(node); }
+	virtual void visit(LOD* node)
+	{
+		++visits;
+		for (auto n : node->levels)
+			n->receive(this);
+	}
+	virtual void visit(Transform* node)
+	{
+		++visits;
+		for (auto n : node->nodes)
+			n->receive(this);
+	}
+};
+
+// The same count, dispatched by StaticTraversal
+struct StaticVisitCounter : public StaticTraversal<StaticVisitCounter>
+{
+	using StaticTraversal<StaticVisitCounter>::visit;
+
+	size_t visits;
+	long   sum;
+
+	StaticVisitCounter() : visits(0), sum(0) {}
+
+	void visit(GeometricObject* node) { ++visits; sum += node->numVertices; }
+	void visit(LOD* node)
+	{
+		++visits;
+		for (auto n : node->levels)
+			visitNode(n);
+	}
+	void visit(Transform* node)
+	{
+		++visits;
+		for (auto n : node->nodes)
+			visitNode(n);
+	}
+};
+
+// Count the scene's nodes with the virtual and the static traversal, each
+//   walking the scene as many times as it takes to make a million visits,
+//   and report the time per visit.  Meant for large scenes, e.g.
+//   -scene cones 100000, so the walks aren't all in cache.
+int runVisitBenchmark()
+{
+	const int passes = 10;
+	const size_t target = 1000000;
+
+	StaticVisitCounter probe;
+	probe.traverse(scene);
+	size_t nodes = std::max<size_t>(probe.visits, 1);
+	size_t walks = (target + nodes - 1) / nodes;
+
+	Samples virtualTime("virtual"), staticTime("static");
+	size_t mismatches = 0;
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		VirtualVisitCounter v;
+		Stopwatch watch;
+		for (size_t i = 0; i < walks; ++i)
+			v.traverse(scene);
+		virtualTime.add(watch.elapsed());
+
+		StaticVisitCounter s;
+		watch.reset();
+		for (size_t i = 0; i < walks; ++i)
+			s.traverse(scene);
+		staticTime.add(watch.elapsed());
+
+		if (v.visits != s.visits || v.sum != s.sum)
+			++mismatches;
+	}
+
+	size_t visits = walks * probe.visits;
+	std::cout << "scene: " << sceneName << "  " << probe.visits
+		<< " nodes, " << walks << " walks = " << visits << " visits, "
+		<< mismatches << " passes with differing counts" << std::endl
+		<< virtualTime << std::endl << staticTime << std::endl
+		<< "per visit: virtual " << virtualTime.mean() * 1.0e6 / visits
+		<< " ns, static " << staticTime.mean() * 1.0e6 / visits << " ns"
+		<< std::endl;
+
+	delete scene;
+	return EXIT_SUCCESS;
+}
+
+// Run kernel over count items reps times, after one untimed pass to warm
+//   the caches, returning nanoseconds per item
+template <typename Kernel>
+double timeKernel(Kernel kernel, int count, int reps)
+{
+	for (int i = 0; i < count; ++i)
+		kernel(i);
+
+	Stopwatch watch;
+	for (int r = 0; r < reps; ++r)
+		for (int i = 0; i < count; ++i)
+			kernel(i);
+	return watch.elapsed() * 1.0e6 / (double(count) * reps);
+}
+
+// Time each mat4 kernel against the scalar loops over benchFrames passes
+//   through a few thousand matrices and vectors, checking that both give
+//   the same results.  Needs no GL context.
+int runMathBenchmark()
+{
+	const int count = 4096;
+	std::vector<mat4> A(count), R(count), S(count);
+	std::vector<vec4> V(count), U(count), W(count);
+	mat4 B = polarview(10.0, 30.0, 45.0, 5.0) * Perspective(80.0, 1.0, 1.0, 100.0);
+
+	for (int i = 0; i < count; ++i)
+	{
+		A[i] = RotateX(i) * RotateY(3.0 * i) * Translate(i, -i, 0.5 * i);
+		V[i] = vec4(i, 2.0 * i, -i, 1.0);
+	}
+
+	struct Result { const char* name; double scalar, simd, error; };
+	std::vector<Result> results;
+	int reps = std::max(benchFrames, 1);
+
+	double matrixError = 0.0, vectorError = 0.0;
+	auto compareMatrices = [&]() {
+		matrixError = 0.0;
+		for (int i = 0; i < count; ++i)
+			for (int j = 0; j < 16; ++j)
+				matrixError = std::max(matrixError,
+					double(std::abs(((GLfloat*)R[i])[j] - ((GLfloat*)S[i])[j])));
+		return matrixError;
+	};
+	auto compareVectors = [&]() {
+		vectorError = 0.0;
+		for (int i = 0; i < count; ++i)
+			for (int j = 0; j < 4; ++j)
+				vectorError = std::max(vectorError,
+					double(std::abs(U[i][j] - W[i][j])));
+		return vectorError;
+	};
+
+	Result multiply = { "mat4 * mat4",
+		timeKernel([&](int i) { kernels::multiplyScalar(A[i], B, R[i]); }, count, reps),
+		timeKernel([&](int i) { kernels::multiply(A[i], B, S[i]); }, count, reps),
+		compareMatrices() };
+	results.push_back(multiply);
+
+	Result transform = { "mat4 * vec4",
+		timeKernel([&](int i) { kernels::transformScalar(B, &V[i].x, &U[i].x); }, count, reps),
+		timeKernel([&](int i) { kernels::transform(B, &V[i].x, &W[i].x); }, count, reps),
+		compareVectors() };
+	results.push_back(transform);
+
+	Result transposed = { "transpose",
+		timeKernel([&](int i) { kernels::transposeScalar(A[i], R[i]); }, count, reps),
+		timeKernel([&](int i) { kernels::transpose(A[i], S[i]); }, count, reps),
+		compareMatrices() };
+	results.push_back(transposed);
+
+	// one call per pass over all the vectors, so reported per vector
+	Result batch = { "batch points",
+		timeKernel([&](int) { kernels::transformPointsScalar(B, &V[0].x, &U[0].x, count); }, 1, reps) / count,
+		timeKernel([&](int) { kernels::transformPoints(B, &V[0].x, &W[0].x, count); }, 1, reps) / count,
+		compareVectors() };
+	results.push_back(batch);
+
+	std::cout << "mat4 kernels: " << kernels::name() << ", " << count
+		<< " items x " << reps << " passes" << std::endl;
+	for (auto& r : results)
+	{
+		std::cout << std::left << std::setw(14) << r.name << std::right
+			<< std::fixed << std::setprecision(2)
+			<< "  scalar " << std::setw(7) << r.scalar << " ns"
+			<< "  simd " << std::setw(7) << r.simd << " ns"
+			<< "  speedup " << std::setw(5) << r.scalar / r.simd << "x"
+			<< std::scientific << std::setprecision(1)
+			<< "  max error " << r.error << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Create sceneCount Transforms, walk them and destroy them, once with new
+//   and delete and once in a SceneGraph's pool, over a few passes.  Then
+//   remove the same number of children from a Transform in a SceneGraph
+//   and destroy each one.
+//   Transforms own no GL objects, so this measures only the allocation
+//   and memory layout, and needs no GL context.
+int runNodeBenchmark()
+{
+	const int passes = 10;
+	int count = sceneCount;
+
+	Samples heapCreate("heap create"), heapWalk("heap walk"),
+		heapDelete("heap delete");
+	Samples poolCreate("pool create"), poolWalk("pool walk"),
+		poolClear("pool clear"), poolRemove("pool remove");
+	GLfloat sum = 0.0;
+
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		std::vector<Transform*> heap;
+		Stopwatch watch;
+		for (int i = 0; i < count; ++i)
+		{
+			heap.push_back(new Transform());
+			heap.back()->xform[0][3] = GLfloat(i);
+		}
+		heapCreate.add(watch.elapsed());
+
+		watch.reset();
+		for (auto t : heap)
+			sum += t->xform[0][3];
+		heapWalk.add(watch.elapsed());
+
+		watch.reset();
+		for (auto t : heap)
+			delete t;
+		heapDelete.add(watch.elapsed());
+
+		SceneGraph* graph = new SceneGraph();
+		watch.reset();
+		for (int i = 0; i < count; ++i)
+			graph->create<Transform>()->xform[0][3] = GLfloat(i);
+		poolCreate.add(watch.elapsed());
+
+		watch.reset();
+		graph->pool<Transform>().forEach([&](Transform* t) {
+			sum += t->xform[0][3];
+		});
+		poolWalk.add(watch.elapsed());
+
+		watch.reset();
+		delete graph;
+		poolClear.add(watch.elapsed());
+
+		// children of one Transform, unlinked and destroyed one at a time
+		graph = new SceneGraph();
+		Transform* root = graph->create<Transform>();
+		graph->addNode(root);
+		std::vector<NodeHandle<Transform>> children;
+		for (int i = 0; i < count; ++i)
+		{
+			children.push_back(graph->create<Transform>());
+			root->addNode(children.back());
+		}
+		unsigned long structure = structureVersion();
+		watch.reset();
+		for (size_t i = children.size(); i-- > 0;)
+		{
+			root->removeNode(children[i]);
+			graph->destroy(children[i]);
+		}
+		poolRemove.add(watch.elapsed());
+		if (!root->nodes.empty() || graph->nodeCount() != 1 ||
+			structureVersion() == structure)
+		{
+			std::cerr << "removal left nodes behind" << std::endl;
+			return EXIT_FAILURE;
+		}
+		delete graph;
+	}
+
+	std::cout << "nodes: " << count << " Transforms x " << passes
+		<< " passes  (checksum " << sum << ")" << std::endl
+		<< heapCreate << std::endl << poolCreate << std::endl
+		<< heapWalk << std::endl << poolWalk << std::endl
+		<< heapDelete << std::endl << poolClear << std::endl
+		<< poolRemove << std::endl
+		<< "create+destroy: heap "
+		<< count / (heapCreate.mean() + heapDelete.mean()) << ", pool "
+		<< count / (poolCreate.mean() + poolClear.mean())
+		<< " nodes/ms" << std::endl;
+
+	return EXIT_SUCCESS;
+}
+
+// Tessellate radius 3 spheres at several steps and compare, for each, the
+//   old triangle strip, which shades every vertex it sends, with the
+//   indexed mesh in grid order and in vertex cache order: vertices and
+//   indices stored, cache misses per triangle (ACMR) and vertices shaded
+//   per draw.  Needs no GL context.
+int runMeshBenchmark()
+{
+	const int steps[] = { 30, 18, 12, 6, 3 };
+
+	std::cout << "sphere meshes: FIFO vertex cache of " << CacheSize
+		<< std::endl;
+	for (int space : steps)
+	{
+		std::vector<Sphere::Vertex> verts;
+		std::vector<GLuint> indices;
+		Sphere::tessellate(3, space, verts, indices, false);
+		float gridACMR = vertexCacheACMR(indices, verts.size());
+
+		Stopwatch build;
+		Sphere::tessellate(3, space, verts, indices);
+		double buildTime = build.elapsed();
+
+		size_t triangles = indices.size() / 3;
+		float acmr = vertexCacheACMR(indices, verts.size());
+		size_t strip = (180 / space) * (360 / space) * 2;
+
+		std::cout << "step " << std::setw(2) << space << ":  strip "
+			<< std::setw(6) << strip << " vertices shaded, "
+			<< std::setw(4) << strip * sizeof(Sphere::Vertex) / 1024
+			<< " KB" << std::endl
+			<< "         indexed " << std::setw(6) << verts.size()
+			<< " vertices, " << std::setw(6) << indices.size()
+			<< " indices, " << std::setw(4)
+			<< (verts.size() * sizeof(Sphere::Vertex) +
+				indices.size() * (verts.size() <= 65536 ? sizeof(GLushort) :
+					sizeof(GLuint))) / 1024 << " KB" << std::endl
+			<< std::fixed << std::setprecision(3)
+			<< "         ACMR " << gridACMR << " grid, " << acmr
+			<< " optimized: " << std::setw(6) << size_t(acmr * triangles)
+			<< " vertices shaded (built in " << std::setprecision(2)
+			<< buildTime << " ms)" << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
 
 int main( int argc, CHAR* argv[] )
 {
@@ -169,15 +1295,78 @@ int main( int argc, CHAR* argv[] )
 	int width, height, channels;
 	glewExperimental = GL_TRUE;
 	glutInit( &argc, argv );
+	parseArgs( argc, argv );
+	if (benchMath)
+		return runMathBenchmark();
+	if (benchNodes)
+		return runNodeBenchmark();
+	if (benchMesh)
+		return runMeshBenchmark();
     glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE );
 	glutInitContextVersion(4, 0);//actual GL features you need to add to the beginning of every main function
 	glutInitContextProfile(GLUT_CORE_PROFILE);
     glutCreateWindow( "A Thing" );
 	glewInit();
+
+	if (shaderCache)
+	{
+		// the directory holding the executable, with its trailing separator
+		std::string exe = argv[0];
+		std::string dir = exe.substr(0, exe.find_last_of("/\\") + 1);
+		SetProgramBinaryCache(dir.empty() ? "./" : dir.c_str());
+	}
+
+	if (benchInstancing)
+		sceneName = "cones";
+
+	Stopwatch startup;
     init();
+	std::cout << "startup: " << startup.elapsed() << " ms" << std::endl;
+	if (occlusionCull)
+		occlusion = new OcclusionCuller();
+	if (staticBatching)
+		batches = new StaticBatches();
+
+	if (benchGather)
+	{
+		glutHideWindow();
+		return runGatherBenchmark();
+	}
+
+	if (benchInstancing)
+	{
+		glutHideWindow();
+		return runInstancingBenchmark();
+	}
+
+	if (benchBvh)
+	{
+		glutHideWindow();
+		return runBvhBenchmark();
+	}
+
+	if (benchVisit)
+	{
+		glutHideWindow();
+		return runVisitBenchmark();
+	}
+
+	// GLUT only makes a context with a window, so -headless renders to an
+	// FBO behind a hidden one; see parseArgs() for running without a
+	// display
+	if (headless)
+	{
+		glutHideWindow();
+		return runHeadless();
+	}
 	
+	if (swapInterval >= 0 && !setSwapInterval(swapInterval))
+		std::cerr << "Can't set the swap interval" << std::endl;
+
+    pacer.restart();
     glutIdleFunc( idle );
     glutKeyboardFunc( keyboard );
+    glutMouseFunc( mouse );
     glutReshapeFunc( reshape );
     glutDisplayFunc( display );
     
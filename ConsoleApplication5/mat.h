@@ -8,8 +8,23 @@
 #define __ANGEL_MAT_H__
 
 #include <cmath>
+#include <cstddef>
 #include "vec.h"
 
+//  The mat4 kernels below use SSE, or AVX where the compiler targets it
+//    (/arch:AVX, -mavx), and plain loops otherwise.  Define ANGEL_NO_SIMD
+//    to force the loops.
+#if !defined(ANGEL_NO_SIMD) && \
+    (defined(__SSE__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#  define ANGEL_SIMD_SSE
+#  include <xmmintrin.h>
+#  if defined(__AVX__)
+#    define ANGEL_SIMD_AVX
+#    include <immintrin.h>
+#  endif
+#endif
+
 using std::cos;
 using std::sin;
 using std::tan;
@@ -347,6 +362,204 @@ mat3 transpose( const mat3& A ) {
                  A[0][2], A[1][2], A[2][2] );
 }
 
+//----------------------------------------------------------------------------
+//
+//  mat4 kernels - operate on row-major 4x4 matrices (16 GLfloats) and
+//    4-component vectors, which need not be aligned.  Each has a scalar
+//    version, always available for comparison, and a version selected at
+//    compile time that mat4's operators call.  A matrix result may not
+//    alias an input; a transformed vector may overwrite its own input.
+//
+
+namespace kernels {
+
+//  Return the SIMD instruction set the kernels were built with
+inline const char* name()
+{
+#if defined(ANGEL_SIMD_AVX)
+    return "AVX";
+#elif defined(ANGEL_SIMD_SSE)
+    return "SSE";
+#else
+    return "scalar";
+#endif
+}
+
+//  r = a * b
+inline void multiplyScalar( const GLfloat* a, const GLfloat* b, GLfloat* r )
+{
+    for ( int i = 0; i < 4; ++i ) {
+        for ( int j = 0; j < 4; ++j ) {
+            GLfloat sum = 0.0f;
+            for ( int k = 0; k < 4; ++k ) {
+                sum += a[4*i + k] * b[4*k + j];
+            }
+            r[4*i + j] = sum;
+        }
+    }
+}
+
+//  r = m * v
+inline void transformScalar( const GLfloat* m, const GLfloat* v, GLfloat* r )
+{
+    GLfloat x = v[0], y = v[1], z = v[2], w = v[3];
+    for ( int i = 0; i < 4; ++i ) {
+        r[i] = m[4*i]*x + m[4*i+1]*y + m[4*i+2]*z + m[4*i+3]*w;
+    }
+}
+
+//  r = transpose( m )
+inline void transposeScalar( const GLfloat* m, GLfloat* r )
+{
+    for ( int i = 0; i < 4; ++i ) {
+        for ( int j = 0; j < 4; ++j ) {
+            r[4*j + i] = m[4*i + j];
+        }
+    }
+}
+
+//  out[i] = m * in[i] for n vectors
+inline void transformPointsScalar( const GLfloat* m, const GLfloat* in,
+                                   GLfloat* out, size_t n )
+{
+    for ( size_t i = 0; i < n; ++i ) {
+        transformScalar( m, in + 4*i, out + 4*i );
+    }
+}
+
+#if defined(ANGEL_SIMD_SSE)
+
+//  Each row of a * b is a linear combination of the rows of b, weighted
+//    by that row of a
+inline void multiply( const GLfloat* a, const GLfloat* b, GLfloat* r )
+{
+#  if defined(ANGEL_SIMD_AVX)
+    // two rows of the result at a time, one per 128-bit lane
+    __m256 b0 = _mm256_broadcast_ps( (const __m128*) (b) );
+    __m256 b1 = _mm256_broadcast_ps( (const __m128*) (b + 4) );
+    __m256 b2 = _mm256_broadcast_ps( (const __m128*) (b + 8) );
+    __m256 b3 = _mm256_broadcast_ps( (const __m128*) (b + 12) );
+
+    for ( int i = 0; i < 16; i += 8 ) {
+        __m256 rows = _mm256_loadu_ps( a + i );
+        __m256 sum = _mm256_mul_ps(
+            _mm256_shuffle_ps( rows, rows, 0x00 ), b0 );
+        sum = _mm256_add_ps( sum, _mm256_mul_ps(
+            _mm256_shuffle_ps( rows, rows, 0x55 ), b1 ) );
+        sum = _mm256_add_ps( sum, _mm256_mul_ps(
+            _mm256_shuffle_ps( rows, rows, 0xaa ), b2 ) );
+        sum = _mm256_add_ps( sum, _mm256_mul_ps(
+            _mm256_shuffle_ps( rows, rows, 0xff ), b3 ) );
+        _mm256_storeu_ps( r + i, sum );
+    }
+#  else
+    __m128 b0 = _mm_loadu_ps( b );
+    __m128 b1 = _mm_loadu_ps( b + 4 );
+    __m128 b2 = _mm_loadu_ps( b + 8 );
+    __m128 b3 = _mm_loadu_ps( b + 12 );
+
+    for ( int i = 0; i < 16; i += 4 ) {
+        __m128 row = _mm_loadu_ps( a + i );
+        __m128 sum = _mm_mul_ps( _mm_shuffle_ps( row, row, 0x00 ), b0 );
+        sum = _mm_add_ps( sum,
+            _mm_mul_ps( _mm_shuffle_ps( row, row, 0x55 ), b1 ) );
+        sum = _mm_add_ps( sum,
+            _mm_mul_ps( _mm_shuffle_ps( row, row, 0xaa ), b2 ) );
+        sum = _mm_add_ps( sum,
+            _mm_mul_ps( _mm_shuffle_ps( row, row, 0xff ), b3 ) );
+        _mm_storeu_ps( r + i, sum );
+    }
+#  endif
+}
+
+//  m * v is the columns of m weighted by the components of v
+inline void transform( const GLfloat* m, const GLfloat* v, GLfloat* r )
+{
+    __m128 c0 = _mm_loadu_ps( m );
+    __m128 c1 = _mm_loadu_ps( m + 4 );
+    __m128 c2 = _mm_loadu_ps( m + 8 );
+    __m128 c3 = _mm_loadu_ps( m + 12 );
+    _MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
+
+    __m128 sum = _mm_mul_ps( c0, _mm_set1_ps( v[0] ) );
+    sum = _mm_add_ps( sum, _mm_mul_ps( c1, _mm_set1_ps( v[1] ) ) );
+    sum = _mm_add_ps( sum, _mm_mul_ps( c2, _mm_set1_ps( v[2] ) ) );
+    sum = _mm_add_ps( sum, _mm_mul_ps( c3, _mm_set1_ps( v[3] ) ) );
+    _mm_storeu_ps( r, sum );
+}
+
+inline void transpose( const GLfloat* m, GLfloat* r )
+{
+    __m128 r0 = _mm_loadu_ps( m );
+    __m128 r1 = _mm_loadu_ps( m + 4 );
+    __m128 r2 = _mm_loadu_ps( m + 8 );
+    __m128 r3 = _mm_loadu_ps( m + 12 );
+    _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+    _mm_storeu_ps( r, r0 );
+    _mm_storeu_ps( r + 4, r1 );
+    _mm_storeu_ps( r + 8, r2 );
+    _mm_storeu_ps( r + 12, r3 );
+}
+
+//  The columns of m are extracted once and reused for every vector
+inline void transformPoints( const GLfloat* m, const GLfloat* in,
+                             GLfloat* out, size_t n )
+{
+    __m128 c0 = _mm_loadu_ps( m );
+    __m128 c1 = _mm_loadu_ps( m + 4 );
+    __m128 c2 = _mm_loadu_ps( m + 8 );
+    __m128 c3 = _mm_loadu_ps( m + 12 );
+    _MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
+
+    size_t i = 0;
+#  if defined(ANGEL_SIMD_AVX)
+    // two vectors at a time, one per 128-bit lane
+    __m256 w0 = _mm256_set_m128( c0, c0 );
+    __m256 w1 = _mm256_set_m128( c1, c1 );
+    __m256 w2 = _mm256_set_m128( c2, c2 );
+    __m256 w3 = _mm256_set_m128( c3, c3 );
+
+    for ( ; i + 2 <= n; i += 2 ) {
+        __m256 v = _mm256_loadu_ps( in + 4*i );
+        __m256 sum = _mm256_mul_ps( w0, _mm256_shuffle_ps( v, v, 0x00 ) );
+        sum = _mm256_add_ps( sum,
+            _mm256_mul_ps( w1, _mm256_shuffle_ps( v, v, 0x55 ) ) );
+        sum = _mm256_add_ps( sum,
+            _mm256_mul_ps( w2, _mm256_shuffle_ps( v, v, 0xaa ) ) );
+        sum = _mm256_add_ps( sum,
+            _mm256_mul_ps( w3, _mm256_shuffle_ps( v, v, 0xff ) ) );
+        _mm256_storeu_ps( out + 4*i, sum );
+    }
+#  endif
+    for ( ; i < n; ++i ) {
+        __m128 v = _mm_loadu_ps( in + 4*i );
+        __m128 sum = _mm_mul_ps( c0, _mm_shuffle_ps( v, v, 0x00 ) );
+        sum = _mm_add_ps( sum, _mm_mul_ps( c1, _mm_shuffle_ps( v, v, 0x55 ) ) );
+        sum = _mm_add_ps( sum, _mm_mul_ps( c2, _mm_shuffle_ps( v, v, 0xaa ) ) );
+        sum = _mm_add_ps( sum, _mm_mul_ps( c3, _mm_shuffle_ps( v, v, 0xff ) ) );
+        _mm_storeu_ps( out + 4*i, sum );
+    }
+}
+
+#else  // !ANGEL_SIMD_SSE
+
+inline void multiply( const GLfloat* a, const GLfloat* b, GLfloat* r )
+    { multiplyScalar( a, b, r ); }
+
+inline void transform( const GLfloat* m, const GLfloat* v, GLfloat* r )
+    { transformScalar( m, v, r ); }
+
+inline void transpose( const GLfloat* m, GLfloat* r )
+    { transposeScalar( m, r ); }
+
+inline void transformPoints( const GLfloat* m, const GLfloat* in,
+                             GLfloat* out, size_t n )
+    { transformPointsScalar( m, in, out, n ); }
+
+#endif  // ANGEL_SIMD_SSE
+
+}  // namespace kernels
+
 //----------------------------------------------------------------------------
 //
 //  mat4.h - 4D square matrix
@@ -422,15 +635,7 @@ class mat4 {
         
     mat4 operator * ( const mat4& m ) const {
         mat4  a( 0.0f );
-
-        for ( int i = 0; i < 4; ++i ) {
-            for ( int j = 0; j < 4; ++j ) {
-                for ( int k = 0; k < 4; ++k ) {
-                    a[i][j] += _m[i][k] * m[k][j];
-                }
-            }
-        }
-
+        kernels::multiply( *this, m, a );
         return a;
     }
 
@@ -455,15 +660,7 @@ class mat4 {
 
     mat4& operator *= ( const mat4& m ) {
         mat4  a( 0.0f );
-
-        for ( int i = 0; i < 4; ++i ) {
-            for ( int j = 0; j < 4; ++j ) {
-                for ( int k = 0; k < 4; ++k ) {
-                    a[i][j] += _m[i][k] * m[k][j];
-                }
-            }
-        }
-
+        kernels::multiply( *this, m, a );
         return *this = a;
     }
 
@@ -477,11 +674,9 @@ class mat4 {
     //
 
     vec4 operator * ( const vec4& v ) const {  // m * v
-        return vec4( _m[0][0]*v.x + _m[0][1]*v.y + _m[0][2]*v.z + _m[0][3]*v.w,
-                     _m[1][0]*v.x + _m[1][1]*v.y + _m[1][2]*v.z + _m[1][3]*v.w,
-                     _m[2][0]*v.x + _m[2][1]*v.y + _m[2][2]*v.z + _m[2][3]*v.w,
-                     _m[3][0]*v.x + _m[3][1]*v.y + _m[3][2]*v.z + _m[3][3]*v.w
-            );
+        vec4  r;
+        kernels::transform( *this, &v.x, &r.x );
+        return r;
     }
         
     //
@@ -525,10 +720,15 @@ mat4 matrixCompMult( const mat4& A, const mat4& B ) {
 
 inline
 mat4 transpose( const mat4& A ) {
-    return mat4( A[0][0], A[1][0], A[2][0], A[3][0],
-                 A[0][1], A[1][1], A[2][1], A[3][1],
-                 A[0][2], A[1][2], A[2][2], A[3][2],
-                 A[0][3], A[1][3], A[2][3], A[3][3] );
+    mat4  T( 0.0f );
+    kernels::transpose( A, T );
+    return T;
+}
+
+//  out[i] = A * in[i] for n vectors; in and out may be the same array
+inline
+void transform( const mat4& A, const vec4* in, vec4* out, size_t n ) {
+    kernels::transformPoints( A, &in->x, &out->x, n );
 }
 
 //////////////////////////////////////////////////////////////////////////////